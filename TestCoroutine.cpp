@@ -1,7 +1,14 @@
 #include "tokoro.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <ranges>
 #include <source_location>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 using namespace tokoro;
@@ -143,7 +150,235 @@ void TestNextFrame()
     std::cout << "TestNextFrame passed\n";
 }
 
+// Next update waits resume in start order before the due delayed waits, stopped ones never resume.
+void TestNextUpdateOrder()
+{
+    // The wait is the queue node: links and the timed queue's node, no copy of the element.
+    using WaitHook = internal::UpdateQueue<Wait*, internal::IntrusiveTimeQueue, double>::Hook;
+    static_assert(sizeof(WaitHook) <= 2 * sizeof(void*) + sizeof(internal::IntrusiveTimeQueue<Wait*>::Hook) + 8);
+
+    double    simTime = 0;
+    Scheduler sched;
+    sched.SetCustomTimer(internal::PresetTimeType::Realtime, [&]() { return simTime; });
+
+    std::vector<int>          order;
+    std::vector<Handle<void>> handles;
+    for (int i = 0; i < 6; ++i)
+    {
+        handles.push_back(sched.Start([&order, i]() -> Async<void> {
+            if (i % 2 == 0)
+                co_await Wait(0.5 - i * 0.1); // 0.5, 0.3, 0.1
+            else
+                co_await Wait();
+            order.push_back(i);
+        }));
+    }
+    handles[3].Stop();
+
+    simTime = 1;
+    sched.Update();
+
+    assert((order == std::vector<int>{1, 5, 4, 2, 0}));
+    std::cout << "TestNextUpdateOrder passed\n";
+}
+
 // Test Stop and cancellation
+// Frame waits resume once on the n-th update, in add order, and never read the timer.
+void TestWaitFrames()
+{
+    Scheduler sched;
+    int       timerCalls = 0;
+    sched.SetCustomTimer(internal::PresetTimeType::Realtime, [&]() { ++timerCalls; return 0.0; });
+
+    // Around the ring size of the frame queue, and far beyond it.
+    const uint32_t frameCounts[] = {0, 1, 2, 5, 5, 15, 16, 17, 200};
+
+    int                              frame = 0;
+    std::vector<std::pair<int, int>> resumes; // id, frame
+    std::vector<Handle<void>>        handles;
+    for (int i = 0; i < static_cast<int>(std::size(frameCounts)); ++i)
+    {
+        handles.push_back(sched.Start([&, i]() -> Async<void> {
+            co_await WaitFrames(frameCounts[i]);
+            resumes.push_back({i, frame});
+            co_await WaitFrames(3);
+            resumes.push_back({i, frame});
+        }));
+    }
+
+    // Stopped ones never resume.
+    Handle stopNear = sched.Start([&]() -> Async<void> { co_await WaitFrames(10); assert(false); });
+    Handle stopFar  = sched.Start([&]() -> Async<void> { co_await WaitFrames(100); assert(false); });
+
+    for (frame = 1; frame <= 300; ++frame)
+    {
+        if (frame == 5)
+        {
+            stopNear.Stop();
+            stopFar.Stop();
+        }
+        sched.Update();
+    }
+
+    assert(timerCalls == 300);
+    assert(resumes.size() == std::size(frameCounts) * 2);
+    for (int i = 0; i < static_cast<int>(std::size(frameCounts)); ++i)
+    {
+        assert((std::count(resumes.begin(), resumes.end(), std::pair<int, int>{i, static_cast<int>(frameCounts[i])}) == 1));
+        assert((std::count(resumes.begin(), resumes.end(), std::pair<int, int>{i, static_cast<int>(frameCounts[i]) + 3}) == 1));
+    }
+
+    // Same frame count, resume in add order.
+    auto first  = std::find(resumes.begin(), resumes.end(), std::pair<int, int>{3, 5});
+    auto second = std::find(resumes.begin(), resumes.end(), std::pair<int, int>{4, 5});
+    assert(first < second);
+
+    std::cout << "TestWaitFrames passed\n";
+}
+
+struct PreciseTimeConfig : DefaultSchedulerConfig
+{
+    static constexpr TimeSampling Sampling = TimeSampling::Precise;
+};
+
+// The timer moves on every read. Snapshot sampling reads it once per Update/Start and gives all
+// waits added there the same base time. Precise sampling reads it for every delayed wait.
+template <typename Config>
+void TestTimeSampling(const char* name)
+{
+    using SchedulerT = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+    using WaitT      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+
+    SchedulerT sched;
+    int        timerCalls = 0;
+    sched.SetCustomTimer(internal::PresetTimeType::Realtime, [&]() { return static_cast<double>(++timerCalls); });
+
+    int              update = 0;
+    std::vector<int> resumeUpdates;
+    auto             waiter = [&]() -> Async<void> {
+        co_await WaitT(10);
+        resumeUpdates.push_back(update);
+        co_await WaitT(10);
+        resumeUpdates.push_back(update);
+    };
+
+    Handle handle = sched.Start([&]() -> Async<void> { co_await All(waiter(), waiter()); });
+    while (handle.IsRunning() && update < 100)
+    {
+        ++update;
+        sched.Update();
+    }
+
+    if constexpr (Config::Sampling == TimeSampling::Snapshot)
+    {
+        assert((resumeUpdates == std::vector<int>{10, 10, 20, 20}));
+        assert(timerCalls == update + 1);
+    }
+    else
+    {
+        assert((resumeUpdates == std::vector<int>{9, 10, 18, 20}));
+        assert(timerCalls == update + 4);
+    }
+
+    std::cout << name << "TestTimeSampling passed\n";
+}
+
+// Timer policy of a manually driven clock.
+struct ManualClock
+{
+    double Now(internal::PresetTimeType) const noexcept
+    {
+        return time;
+    }
+
+    double time = 0;
+};
+
+struct ManualClockConfig : DefaultSchedulerConfig
+{
+    template <typename TimeEnum>
+    using Timer = ManualClock;
+};
+
+struct SteadyTimerConfig : DefaultSchedulerConfig
+{
+    template <typename TimeEnum>
+    using Timer = SteadyTimer<TimeEnum>;
+};
+
+void TestTimerPolicy()
+{
+    using ClockScheduler = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, ManualClockConfig>;
+    using ClockWait      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, ManualClockConfig>;
+
+    ClockScheduler sched;
+    ManualClock&   clock = sched.GetTimer();
+
+    std::vector<double> resumeTimes;
+    Handle              handle = sched.Start([&]() -> Async<void> {
+        co_await ClockWait(1.5);
+        resumeTimes.push_back(clock.time);
+        co_await ClockWait(0.25);
+        resumeTimes.push_back(clock.time);
+    });
+
+    for (int i = 0; i < 100 && handle.IsRunning(); ++i)
+    {
+        clock.time += 0.25;
+        sched.Update();
+    }
+    assert((resumeTimes == std::vector<double>{1.5, 1.75}));
+
+    // Static policy
+    using SteadyScheduler = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, SteadyTimerConfig>;
+    using SteadyWait      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, SteadyTimerConfig>;
+
+    SteadyScheduler steadySched;
+    Handle          steadyHandle = steadySched.Start([&]() -> Async<void> {
+        co_await SteadyWait();
+        co_await SteadyWait(0.001);
+    });
+    while (steadyHandle.IsRunning())
+        steadySched.Update();
+
+    std::cout << "TestTimerPolicy passed\n";
+}
+
+struct TscTimerConfig : DefaultSchedulerConfig
+{
+    template <typename TimeEnum>
+    using Timer = TscTimer<TimeEnum>;
+};
+
+void TestTscTimer()
+{
+    using TscScheduler = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, TscTimerConfig>;
+    using TscWait      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, TscTimerConfig>;
+
+    // Reads never go backwards.
+    double last = internal::TscClock::Now();
+    for (int i = 0; i < 1000; ++i)
+    {
+        const double now = internal::TscClock::Now<true>();
+        assert(now >= last);
+        last = now;
+    }
+
+    TscScheduler sched;
+    const auto   start    = std::chrono::steady_clock::now();
+    const double tscStart = internal::TscClock::Now();
+    Handle       handle   = sched.Start([&]() -> Async<void> { co_await TscWait(0.005); });
+    while (handle.IsRunning())
+        sched.Update();
+
+    // Exact on the clock the scheduler reads. Against steady_clock only a gross calibration error
+    // fails, e.g. a wrong unit: a loaded machine may skew it, and only makes the wait longer.
+    assert(internal::TscClock::Now() - tscStart >= 0.005);
+    assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(1));
+
+    std::cout << "TestTscTimer passed (" << (internal::TscClock::IsTscUsed() ? "TSC" : "steady_clock fallback") << ")\n";
+}
+
 void TestStop()
 {
     Scheduler sched;
@@ -205,6 +440,219 @@ void TestUseHandleAfterSchedulerDestroyed()
     std::cout << "TestUseHandleAfterSchedulerDestroyed passed\n";
 }
 
+// Handles are one 64 bit id, they find their scheduler through the scheduler registry.
+void TestCompactHandle()
+{
+    static_assert(sizeof(Handle<int>) == sizeof(uint64_t));
+    static_assert(sizeof(Handle<void>) == sizeof(uint64_t));
+
+    // A scheduler made after the first one died doesn't take over its handles.
+    Handle<int> stale;
+    {
+        Scheduler dead;
+        stale = dead.Start([]() -> Async<int> { co_return 1; });
+        assert(stale.GetState().value() == AsyncState::Succeed);
+    }
+    Scheduler sched;
+    Handle<int> live = sched.Start([]() -> Async<int> { co_return 2; });
+    assert(!stale.GetState().has_value());
+    assert(!stale.TakeResult().has_value());
+    assert(live.TakeResult().value() == 2);
+
+    // Forget is recorded by the scheduler, the handle has no room for it.
+    int  finished = 0;
+    auto Tick     = [&]() -> Async<void> {
+        co_await Wait(0);
+        ++finished;
+    };
+    {
+        Handle<void> forgotten = sched.Start(Tick);
+        forgotten.Forget();
+        Handle<void> bound = sched.Start(Tick);
+    }
+    sched.Update();
+    assert(finished == 1);
+
+    // Handles of many schedulers, alive together and one after another.
+    for (int round = 0; round < 3; ++round)
+    {
+        std::vector<std::unique_ptr<Scheduler>> schedulers;
+        std::vector<Handle<int>>                handles;
+        for (int index = 0; index < 100; ++index)
+        {
+            schedulers.push_back(std::make_unique<Scheduler>());
+            handles.push_back(schedulers.back()->Start([index]() -> Async<int> { co_return index; }));
+        }
+        for (int index = 0; index < 100; index += 2)
+            schedulers[index].reset();
+        for (int index = 0; index < 100; ++index)
+        {
+            const std::optional<int> result = handles[index].TakeResult();
+            assert(index % 2 == 0 ? !result.has_value() : result.value() == index);
+        }
+    }
+
+    // A stale handle meets later schedulers at its registry index, beyond one round of all indices.
+    // They number their coroutines after the dead one's, so it never reaches theirs.
+    {
+        Handle<void> old;
+        {
+            Scheduler dead;
+            old = dead.Start([]() -> Async<void> { co_await Wait(1e9); });
+        }
+        for (int lifetime = 0; lifetime < 5000; ++lifetime)
+        {
+            Scheduler    later;
+            Handle<void> live = later.Start([]() -> Async<void> { co_await Wait(1e9); });
+            old.Stop();
+            assert(!old.GetState().has_value());
+            if (lifetime == 4999)
+                old = {};
+            assert(live.IsRunning());
+        }
+    }
+
+    std::cout << "TestCompactHandle passed\n";
+}
+
+// Generations run out with few bits: slots and registry indices are retired, ids never come back.
+void TestGenerationWrap()
+{
+    // A slot map with generations 1..7.
+    internal::SlotMap<int, 1, 8, 3> slots;
+    std::vector<uint64_t>           seen;
+    for (int i = 0; i < 40; ++i)
+    {
+        const uint64_t id = slots.Emplace().first;
+        assert(std::find(seen.begin(), seen.end(), id) == seen.end());
+        for (uint64_t old : seen)
+            assert(slots.Find(old) == nullptr);
+        seen.push_back(id);
+        slots.Erase(id);
+    }
+    assert(slots.LastGeneration() == 7);
+
+    // A map continuing after it never hands out its ids.
+    internal::SlotMap<int, 1, 8, 5> first;
+    for (int i = 0; i < 5; ++i)
+        first.Erase(first.Emplace().first);
+    internal::SlotMap<int, 1, 8, 5> second(std::pmr::get_default_resource(), first.LastGeneration() + 1);
+    assert(second.Emplace().first >> 8 == first.LastGeneration() + 1);
+
+    // A registry with 4 indices and generations 1..7.
+    struct Dummy
+    {
+    };
+    using TinyRegistry = internal::BasicSchedulerRegistry<Dummy, 2, 3>;
+    Dummy                    dummy;
+    std::vector<uint64_t>    lastGenerations(TinyRegistry::Capacity, 0);
+    int                      registered = 0;
+    bool                     exhausted  = false;
+    while (!exhausted)
+    {
+        try
+        {
+            const auto registration = TinyRegistry::Register(&dummy);
+            assert(TinyRegistry::Find(registration.index) == &dummy);
+            assert(registration.firstGeneration > lastGenerations[registration.index]);
+
+            // Every scheduler uses two generations.
+            lastGenerations[registration.index] = registration.firstGeneration + 1;
+            TinyRegistry::Unregister(registration.index, lastGenerations[registration.index]);
+            assert(TinyRegistry::Find(registration.index) == nullptr);
+            ++registered;
+        }
+        catch (const std::length_error&)
+        {
+            exhausted = true;
+        }
+    }
+    assert(registered == 4 * 4); // Generations 1-2, 3-4, 5-6, 7-8 per index, then retired.
+
+    std::cout << "TestGenerationWrap passed\n";
+}
+
+// Spawned coroutines run like forgotten ones, without a handle.
+void TestSpawn()
+{
+    int  finished = 0;
+    auto Tick     = [&](int frames) -> Async<void> {
+        for (int i = 0; i < frames; ++i)
+            co_await Wait();
+        ++finished;
+    };
+
+    {
+        Scheduler sched;
+        assert(sched.Spawn(Tick, 0)); // Finishes inside Spawn.
+        assert(finished == 1);
+
+        assert(sched.Spawn(Tick, 2));
+        sched.Update();
+        assert(finished == 1);
+        sched.Update();
+        assert(finished == 2);
+
+        // Results and exceptions are dropped.
+        assert(sched.Spawn([]() -> Async<int> { co_return 1; }));
+        assert(sched.Spawn([]() -> Async<void> {
+            co_await Wait();
+            throw std::runtime_error("dropped");
+        }));
+        sched.Update();
+
+        // Still running when the scheduler is destroyed.
+        assert(sched.Spawn(Tick, 1000));
+    }
+    assert(finished == 2);
+
+    std::cout << "TestSpawn passed\n";
+}
+
+// Handles held by coroutines may outlive their coroutines while the scheduler destroys all of them.
+// They see stale ids, and must act like the coroutine is gone.
+void TestHandleInCoroutineTeardown()
+{
+    struct OnExit
+    {
+        std::function<void()> func;
+        ~OnExit()
+        {
+            func();
+        }
+    };
+
+    bool checked = false;
+    {
+        Scheduler sched;
+
+        // Destroyed before the one holding its handle.
+        Handle<void> forever = sched.Start([]() -> Async<void> { co_await Wait(1e9); });
+        sched.Start([&]() -> Async<void> {
+                 Handle<void> held = std::move(forever);
+                 OnExit       onExit{[&]() {
+                     assert(!held.GetState().has_value());
+                     assert(!held.IsRunning());
+                     checked = true;
+                 }};
+                 co_await Wait(1e9);
+             })
+            .Forget();
+
+        // Ids of finished and released coroutines are reused with a new generation.
+        for (int i = 0; i < 1000; ++i)
+        {
+            Handle h = sched.Start([]() -> Async<int> { co_return 1; });
+            assert(h.GetState().value() == AsyncState::Succeed);
+            assert(h.TakeResult().value() == 1);
+        }
+        sched.Update();
+    }
+    assert(checked);
+
+    std::cout << "TestHandleInCoroutineTeardown passed\n";
+}
+
 void TestStartInCoroutine()
 {
     Scheduler sched;
@@ -322,6 +770,51 @@ enum class TimeType
 using MyScheduler = SchedulerBP<UpdateType, TimeType>;
 using MyWait      = WaitBP<UpdateType, TimeType>;
 
+// Deferred starts run nothing at the call site, their body starts with the update they're queued for.
+void TestStartDeferred()
+{
+    MyScheduler sched;
+    std::vector<std::string> log;
+    auto                     Record = [&](std::string name, int frames) -> Async<int> {
+        log.push_back(name);
+        for (int i = 0; i < frames; ++i)
+            co_await MyWait(UpdateType::Update);
+        co_return frames;
+    };
+
+    auto early   = sched.StartDeferred(UpdateType::Update, Record, "early", 0);
+    auto late    = sched.StartDeferred(UpdateType::PostUpdate, Record, "late", 1);
+    auto stopped = sched.StartDeferred(UpdateType::Update, Record, "stopped", 0);
+    assert(log.empty() && early.IsRunning() && late.IsRunning());
+
+    stopped.Stop();
+    assert(stopped.GetState() == AsyncState::Stopped);
+
+    sched.Update(UpdateType::PreUpdate, TimeType::EmuRealTime);
+    assert(log.empty());
+    sched.Update(UpdateType::Update, TimeType::EmuRealTime);
+    assert(log == std::vector<std::string>{"early"});
+    assert(early.TakeResult().value() == 0);
+
+    sched.Update(UpdateType::PostUpdate, TimeType::EmuRealTime);
+    assert((log == std::vector<std::string>{"early", "late"}));
+    assert(late.IsRunning());
+    sched.Update(UpdateType::Update, TimeType::EmuRealTime);
+    assert(late.TakeResult().value() == 1);
+
+    // Arguments are kept like Start() keeps them, std::ref included.
+    int  value  = 0;
+    auto handle = sched.StartDeferred(UpdateType::Update, [](int& target, const std::string& source) -> Async<void> {
+        target = static_cast<int>(source.size());
+        co_return;
+    },
+                                      std::ref(value), std::string("seven"));
+    sched.Update(UpdateType::Update, TimeType::EmuRealTime);
+    assert(value == 5 && handle.GetState() == AsyncState::Succeed);
+
+    std::cout << "TestStartDeferred passed\n";
+}
+
 void TestCustomUpdateAndTimers()
 {
     MyScheduler sched;
@@ -412,6 +905,52 @@ void TestCustomUpdateAndTimers()
     std::cout << "TestCustomUpdateAndTimers passed\n";
 }
 
+// TestIntegerTimeDomain
+//
+enum class TickTimeType
+{
+    Realtime = 0,
+    Count,
+};
+
+// Time of TickTimeType is counted in integer milliseconds.
+template <>
+struct tokoro::TimeTraits<TickTimeType>
+{
+    using Duration = std::chrono::milliseconds;
+};
+
+template <typename Config = DefaultSchedulerConfig>
+void TestIntegerTimeDomain(const char* name = "")
+{
+    using TickScheduler = SchedulerBP<internal::PresetUpdateType, TickTimeType, Config>;
+    using TickWait      = WaitBP<internal::PresetUpdateType, TickTimeType, Config>;
+
+    TickScheduler sched;
+    int64_t       now = 0;
+    sched.SetCustomTimer(TickTimeType::Realtime, [&]() { return now; });
+
+    std::vector<int64_t> resumeTimes;
+    Handle               handle = sched.Start([&]() -> Async<void> {
+        co_await TickWait(std::chrono::milliseconds(30));
+        resumeTimes.push_back(now);
+        // Delays are rounded up to whole milliseconds, never resume early.
+        co_await TickWait(std::chrono::microseconds(10001));
+        resumeTimes.push_back(now);
+        co_await TickWait(0.0305);
+        resumeTimes.push_back(now);
+        co_await TickWait(std::chrono::seconds(0));
+        resumeTimes.push_back(now);
+    });
+
+    for (; now < 1000 && handle.IsRunning(); ++now)
+        sched.Update(internal::PresetUpdateType::Update, TickTimeType::Realtime);
+
+    assert(handle.GetState().value() == AsyncState::Succeed);
+    assert((resumeTimes == std::vector<int64_t>{30, 41, 72, 73}));
+    std::cout << name << "TestIntegerTimeDomain passed\n";
+}
+
 void TestWaitUntilAndWhile()
 {
     Scheduler sched;
@@ -726,56 +1265,216 @@ void TestHandle()
 }
 
 // Member function test
-void TestMemberCoroutines()
+Async<size_t> ReadAfterWait(const std::string& text)
 {
-    class Test
-    {
-    public:
-        void StartCount()
-        {
-            GlobalScheduler().Start(&Test::CountCoro, this, 3, 2).Forget();
-        }
-        int value = 0;
+    co_await Wait();
+    co_return text.size();
+}
 
-    private:
-        Async<void> CountCoro(int countTimes, int step)
-        {
-            for (int i = 0; i < countTimes; ++i)
-            {
-                co_await Wait();
-                value += step;
-            }
-        }
-    };
+// Captures and reference parameters must outlive the coroutine, whether they're stored inline or in the frame.
+void TestStartCaptures()
+{
+    Scheduler sched;
 
-    Test test;
-    test.StartCount();
+    int  small       = 7;
+    auto smallHandle = sched.Start([small]() -> Async<int> {
+        co_await Wait();
+        co_return small;
+    });
 
-    for (int i = 0; i < 10; ++i)
+    std::array<int, 64> big;
+    for (int i = 0; i < 64; ++i)
+        big[i] = i;
+    auto bigHandle = sched.Start([big]() -> Async<int> {
+        co_await Wait();
+        int sum = 0;
+        for (int value : big)
+            sum += value;
+        co_return sum;
+    });
+
+    auto smallArg = sched.Start(ReadAfterWait, std::string("short"));
+    auto bigArg   = sched.Start([](const std::string& text, std::array<int, 64>) { return ReadAfterWait(text); }, std::string(100, 'x'), big);
+
+    auto moveOnly = sched.Start([ptr = std::make_unique<int>(3)]() -> Async<int> {
+        co_await Wait();
+        co_return *ptr;
+    });
+
+    sched.Update();
+    assert(smallHandle.TakeResult().value() == 7);
+    assert(bigHandle.TakeResult().value() == 63 * 64 / 2);
+    assert(smallArg.TakeResult().value() == 5);
+    assert(bigArg.TakeResult().value() == 100);
+    assert(moveOnly.TakeResult().value() == 3);
+
+    // Exceptions pass through the wrapper of large captures.
+    auto throwing = sched.Start([big]() -> Async<int> {
+        co_await Wait();
+        throw std::runtime_error("fail");
+        co_return big[0];
+    });
+    sched.Update();
+    assert(throwing.GetState() == AsyncState::Failed);
+
+    std::cout << "TestStartCaptures passed\n";
+}
+
+// Large, move-only and without default constructor.
+struct BigResult
+{
+    explicit BigResult(int value)
+        : ptr(std::make_unique<int>(value))
     {
-        GlobalScheduler().Update();
     }
 
-    assert(test.value == 6);
-    std::cout << "TestMemberCoroutines passed\n";
+    std::unique_ptr<int>      ptr;
+    std::array<int64_t, 32> padding{};
+};
+
+Async<BigResult> MakeBigResult(int value)
+{
+    co_await Wait();
+    co_return BigResult(value);
 }
 
-// A test to make sure no extra object constructed or copied.
-//
-class LifeTimeChecker
+Async<int&> PickLarger(int& a, int& b)
 {
-public:
-    std::string name;
+    co_await Wait();
+    co_return a > b ? a : b;
+}
 
-    inline static int ConstructCount  = 0;
-    inline static int CopyCount       = 0;
-    inline static int MoveCount       = 0;
-    inline static int CopyAssignCount = 0;
-    inline static int MoveAssignCount = 0;
-    inline static int DestructCount   = 0;
+void TestTypedResults()
+{
+    Scheduler sched;
+    int       a = 1, b = 2;
 
-    static void ClearCounts()
-    {
+    auto handle = sched.Start([&]() -> Async<BigResult> {
+        int& larger = co_await PickLarger(a, b);
+        assert(&larger == &b);
+        larger = 10;
+
+        BigResult big = co_await MakeBigResult(3);
+
+        auto [left, right] = co_await All(MakeBigResult(4), PickLarger(a, b));
+        assert(*left.ptr == 4 && &right.get() == &b);
+
+        auto [first, second] = co_await Any(MakeBigResult(5), PickLarger(a, b));
+        assert(first.has_value() != second.has_value());
+
+        co_return BigResult(*big.ptr + *left.ptr);
+    });
+
+    while (handle.IsRunning())
+        sched.Update();
+    assert(b == 10);
+    assert(*handle.TakeResult().value().ptr == 7);
+
+    std::cout << "TestTypedResults passed\n";
+}
+
+Async<int> CachedValue(int value)
+{
+    co_return value;
+}
+
+Async<int> NextFrameValue(int value)
+{
+    co_await Wait();
+    co_return value;
+}
+
+// Children which finish without suspending let the parent go on inline, without growing the stack.
+void TestSynchronousCompletion()
+{
+    Scheduler sched;
+
+    auto single = sched.Start([]() -> Async<int> {
+        int sum = 0;
+        for (int i = 0; i < 1000000; ++i)
+            sum += co_await CachedValue(1);
+        co_return sum;
+    });
+    assert(single.TakeResult().value() == 1000000);
+
+    auto all = sched.Start([]() -> Async<int> {
+        auto [a, b] = co_await All(CachedValue(1), CachedValue(2));
+        co_return a + b;
+    });
+    assert(all.TakeResult().value() == 3);
+
+    bool secondStarted = false;
+    auto any           = sched.Start([&]() -> Async<int> {
+        auto [a, b] = co_await Any(CachedValue(1), [&]() -> Async<int> {
+            secondStarted = true;
+            co_return 2;
+        }());
+        co_return a.value_or(0) + b.value_or(0);
+    });
+    assert(any.TakeResult().value() == 1 && !secondStarted);
+
+    // Mixed: suspends until the slow child is done.
+    auto mixed = sched.Start([]() -> Async<int> {
+        auto [a, b] = co_await All(CachedValue(1), NextFrameValue(2));
+        co_return a + b;
+    });
+    assert(mixed.IsRunning());
+    sched.Update();
+    assert(mixed.TakeResult().value() == 3);
+
+    std::cout << "TestSynchronousCompletion passed\n";
+}
+
+void TestMemberCoroutines()
+{
+    class Test
+    {
+    public:
+        void StartCount()
+        {
+            GlobalScheduler().Start(&Test::CountCoro, this, 3, 2).Forget();
+        }
+        int value = 0;
+
+    private:
+        Async<void> CountCoro(int countTimes, int step)
+        {
+            for (int i = 0; i < countTimes; ++i)
+            {
+                co_await Wait();
+                value += step;
+            }
+        }
+    };
+
+    Test test;
+    test.StartCount();
+
+    for (int i = 0; i < 10; ++i)
+    {
+        GlobalScheduler().Update();
+    }
+
+    assert(test.value == 6);
+    std::cout << "TestMemberCoroutines passed\n";
+}
+
+// A test to make sure no extra object constructed or copied.
+//
+class LifeTimeChecker
+{
+public:
+    std::string name;
+
+    inline static int ConstructCount  = 0;
+    inline static int CopyCount       = 0;
+    inline static int MoveCount       = 0;
+    inline static int CopyAssignCount = 0;
+    inline static int MoveAssignCount = 0;
+    inline static int DestructCount   = 0;
+
+    static void ClearCounts()
+    {
         ConstructCount  = 0;
         CopyCount       = 0;
         MoveCount       = 0;
@@ -874,6 +1573,121 @@ void TestReturnObjLifetime()
     std::cout << "TestReturnObjLifetime passed\n";
 }
 
+// Drive a time queue directly, check the pop order, removal and the same update rule.
+template <template <typename, typename> class Queue, typename TimeT = double>
+void TestTimeQueue(const char* name)
+{
+    struct Item
+    {
+        typename Queue<Item*, TimeT>::Hook hook;
+        int                                id;
+        TimeT                              time;
+    };
+
+    Queue<Item*, TimeT> queue;
+    std::vector<Item> items(64);
+    for (int i = 0; i < 64; ++i)
+    {
+        items[i].id   = i;
+        items[i].time = i < 48 ? (i * 37) % 16 : i / 4; // Plenty of equal times, some in a row
+        queue.AddTimed(items[i].hook, items[i].time, &items[i]);
+    }
+
+    // Remove a few, including the first one to pop and members of same time runs.
+    for (int i = 0; i < 64; i += 5)
+    {
+        queue.Remove(items[i].hook);
+        assert(!items[i].hook.IsLinked());
+    }
+
+    int      popped   = 0;
+    Item*    last     = nullptr;
+    Item     reAdded  = {};
+    bool     reAddRun = false;
+    for (TimeT time = 0; time < 16; time += 1)
+    {
+        queue.SetupUpdate(time);
+        while (queue.CheckUpdate())
+        {
+            Item* item = queue.Pop();
+            assert(!item->hook.IsLinked());
+            assert(item->time <= time);
+            assert(last == nullptr || last->time < item->time || (last->time == item->time && last->id < item->id));
+            last = item;
+            ++popped;
+
+            if (item == &reAdded)
+            {
+                reAddRun = true;
+                assert(time == 5);
+                continue;
+            }
+
+            // Added in this update and due already, must run in next update.
+            if (time == 4 && !reAdded.hook.IsLinked())
+                queue.AddTimed(reAdded.hook, 0, &reAdded);
+        }
+        last = nullptr;
+    }
+
+    assert(reAddRun);
+    assert(popped == 64 - 13 + 1);
+    queue.Clear();
+
+    std::cout << "TestTimeQueue<" << name << "> passed\n";
+}
+
+template <typename T, typename TimeT>
+using DaryHeap8Queue = internal::DaryHeapTimeQueue<T, TimeT, 8>;
+
+// Waits spread over all wheel levels and the overflow list, driven with big and small time steps.
+void TestTimingWheelLongDelays()
+{
+    struct Item
+    {
+        internal::TimingWheelTimeQueue<Item*>::Hook hook;
+        double                                      time;
+    };
+
+    const double delays[] = {0.0005, 0.016, 0.3, 0.256, 1, 65.536, 70, 3600, 20000, 5e6, 1e7};
+
+    internal::TimingWheelTimeQueue<Item*> queue;
+    std::vector<Item>                     items;
+    items.reserve(std::size(delays) * 2);
+    for (double delay : delays)
+    {
+        items.push_back({{}, delay});
+        queue.AddTimed(items.back().hook, delay, &items.back());
+        items.push_back({{}, delay + 0.0001});
+        queue.AddTimed(items.back().hook, delay + 0.0001, &items.back());
+    }
+    queue.Remove(items[3].hook);
+
+    size_t popped   = 1;
+    double lastTime = 0;
+    double time     = 0;
+    for (int step = 0; popped < items.size(); ++step)
+    {
+        // Small steps first, then jump over large ranges.
+        time += step < 2000 ? 0.0166 : 1000 * step;
+        queue.SetupUpdate(time);
+        while (queue.CheckUpdate())
+        {
+            Item* item = queue.Pop();
+            assert(item != &items[3]);
+            assert(item->time <= time && item->time >= lastTime);
+            lastTime = item->time;
+            ++popped;
+        }
+
+        // Nothing due should be left behind.
+        for (const Item& item : items)
+            assert(item.time > time || !item.hook.IsLinked());
+    }
+
+    std::cout << "TestTimingWheelLongDelays passed\n";
+}
+
 class Rand
 {
 public:
@@ -904,15 +1718,19 @@ private:
     static uint32_t mState;
 };
 
+template <typename WaitT = Wait, bool SameDelay = false>
 Async<uint32_t> FibCoro(uint32_t n)
 {
     if (n < 2)
         co_return n;
 
-    co_await Wait(Rand::Float(0.0f, 1.0f));
+    if constexpr (SameDelay)
+        co_await WaitT(0.5);
+    else
+        co_await WaitT(Rand::Float(0.0f, 1.0f));
 
-    auto a  = FibCoro(n - 1);
-    auto b  = FibCoro(n - 2);
+    auto a  = FibCoro<WaitT, SameDelay>(n - 1);
+    auto b  = FibCoro<WaitT, SameDelay>(n - 2);
     int  ra = co_await a;
     int  rb = co_await b;
     co_return ra + rb;
@@ -935,12 +1753,394 @@ int Fibonacci(int n)
 
 uint32_t Rand::mState = 0;
 
+// Global allocations, counted for TestZeroAllocation. Every replaceable form of operator new and
+// delete is replaced, so each pointer is freed by the allocator it came from.
+std::atomic<size_t> gAllocations = 0;
+
+void* CountedAllocate(std::size_t size, std::size_t alignment) noexcept
+{
+    ++gAllocations;
+    if (size == 0)
+        size = 1;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        return std::malloc(size);
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* CountedAllocateOrThrow(std::size_t size, std::size_t alignment)
+{
+    if (void* ptr = CountedAllocate(size, alignment))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size)
+{
+    return CountedAllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](std::size_t size)
+{
+    return CountedAllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return CountedAllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return CountedAllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+// Once warmed up, starting, stopping, waiting and nested co_await don't allocate.
+template <typename Config = DefaultSchedulerConfig>
+void TestZeroAllocation(int frames, const char* name = "")
+{
+    using SchedulerT = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+    using WaitT      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+
+    double     simTime = 0.0;
+    SchedulerT sched;
+    sched.SetCustomTimer(internal::PresetTimeType::Realtime, [&]() { return simTime; });
+    sched.Reserve(4096, 16384);
+
+    // The workload of StressTest, in a steady state: every frame starts coroutines, and the
+    // handles they replace stop their old coroutines if still running.
+    // The first run warms up the frame pool to the peak of the workload, the second one replays it.
+    std::vector<Handle<int>> handles(512);
+    auto                     run = [&]() {
+        Rand::SetSeed(1);
+        for (int frame = 0; frame < frames; ++frame)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                handles[(frame * 4 + i) % handles.size()] = sched.Start([](uint32_t n) -> Async<int> {
+                    co_return co_await FibCoro<WaitT>(n);
+                },
+                                                                        Rand::Int(3, 11));
+            }
+            sched.Spawn([](uint32_t n) -> Async<void> { co_await FibCoro<WaitT>(n); }, Rand::Int(3, 7));
+            sched.Update();
+            simTime += 1.0 / 60.0;
+        }
+
+        for (auto& handle : handles)
+            handle = {};
+    };
+
+    run();
+    const size_t allocations = gAllocations;
+    run();
+    assert(gAllocations == allocations);
+
+    std::cout << name << "TestZeroAllocation(" << frames << ") passed\n";
+}
+
+// Counts what goes through it, on top of an upstream resource.
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream)
+        : mUpstream(upstream)
+    {
+    }
+
+    size_t allocations = 0;
+    size_t bytesInUse  = 0;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        ++allocations;
+        bytesInUse += bytes;
+        return mUpstream->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+    {
+        bytesInUse -= bytes;
+        mUpstream->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* mUpstream;
+};
+
+// Frames, results and containers of a scheduler all come from its memory resource.
+template <typename Config = DefaultSchedulerConfig>
+void TestMemoryResource(const char* name = "")
+{
+    using SchedulerT = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+    using WaitT      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+
+    // A fixed buffer with no upstream, so any allocation missing the resource would go to global new.
+    static std::byte                    buffer[1 << 20];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    CountingResource                    resource(&arena);
+    {
+        using Result = std::array<uint32_t, 16>; // Too large for the inline result slot.
+
+        std::vector<Handle<Result>> handles;
+        handles.reserve(64);
+
+        // Nothing below touches the global heap, constructing the scheduler included.
+        const size_t allocations = gAllocations;
+
+        double     simTime = 0.0;
+        SchedulerT sched(&resource);
+        assert(sched.GetMemoryResource() == &resource);
+
+        Rand::SetSeed(2);
+        for (int i = 0; i < 64; ++i)
+        {
+            handles.push_back(sched.Start([](uint32_t n) -> Async<Result> {
+                co_return Result{co_await FibCoro<WaitT>(n)};
+            },
+                                          Rand::Int(3, 8)));
+        }
+
+        sched.SetCustomTimer(internal::PresetTimeType::Realtime, [&]() { return simTime; });
+        while (std::any_of(handles.begin(), handles.end(), [](auto& handle) { return handle.IsRunning(); }))
+        {
+            sched.Update();
+            simTime += 1.0 / 60.0;
+        }
+        for (auto& handle : handles)
+            assert(handle.TakeResult().has_value());
+
+        assert(gAllocations == allocations);
+        assert(resource.allocations > 0);
+    }
+    assert(resource.bytesInUse == 0);
+
+    std::cout << name << "TestMemoryResource passed\n";
+}
+
+using FixedConfig    = FixedCapacityConfig<8, 16>;
+using FixedScheduler = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, FixedConfig>;
+using FixedWait      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, FixedConfig>;
+
+Async<int> FixedNested(int depth)
+{
+    if (depth == 0)
+    {
+        co_await FixedWait();
+        co_return 0;
+    }
+    co_return 1 + co_await FixedNested(depth - 1);
+}
+
+// A fixed capacity scheduler reports a full table or frame pool from Start, and never allocates.
+void TestFixedCapacity()
+{
+    // The coroutine table is sized for MaxCoroutines, the scheduler is mostly its frames.
+    static_assert(sizeof(FixedScheduler) < 16 * (512 + 64) + 4096);
+
+    auto sched = std::make_unique<FixedScheduler>();
+
+    const size_t allocations = gAllocations;
+    {
+        std::vector<Handle<int>> handles;
+        handles.reserve(16);
+        const size_t reserved = gAllocations;
+
+        for (int i = 0; i < 8; ++i)
+        {
+            handles.push_back(sched->Start(FixedNested, 1));
+            assert(handles.back().IsValid());
+        }
+        auto full = sched->Start(FixedNested, 1);
+        assert(!full.IsValid());
+        assert(!sched->Spawn(FixedNested, 1));
+
+        sched->Update();
+        for (auto& handle : handles)
+            assert(handle.TakeResult().value() == 1);
+        handles.clear();
+
+        // Frames run out before the table: the nested coroutine which finds none fails.
+        auto deep = sched->Start(FixedNested, 20);
+        assert(deep.GetState() == AsyncState::Failed);
+        bool caught = false;
+        try
+        {
+            deep.TakeResult();
+        }
+        catch (const std::bad_alloc&)
+        {
+            caught = true;
+        }
+        assert(caught);
+
+        // A root frame, or a start function which isn't stored inline, larger than a block fails
+        // in Start, without a handle.
+        auto huge = sched->Start([]() -> Async<int> {
+            std::array<char, 1024> buffer{};
+            co_await FixedWait();
+            co_return buffer[0];
+        });
+        assert(!huge.IsValid());
+        std::array<char, 1024> captured{};
+        auto hugeCapture = sched->Start([captured]() -> Async<int> { co_return captured[0]; });
+        assert(!hugeCapture.IsValid());
+        assert(!sched->Spawn([captured]() -> Async<void> { co_return; }));
+
+        auto again = sched->Start(FixedNested, 3);
+        sched->Update();
+        assert(again.TakeResult().value() == 3);
+        assert(gAllocations == reserved);
+    }
+    sched.reset();
+    assert(gAllocations == allocations + 1); // The vector of handles.
+
+    // Every frame in use when a coroutine with a large result finishes: it goes into its own frame.
+    using TwoFrameConfig    = FixedCapacityConfig<8, 2, 512>;
+    using TwoFrameScheduler = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, TwoFrameConfig>;
+    using TwoFrameWait      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, TwoFrameConfig>;
+    auto twoFrames          = std::make_unique<TwoFrameScheduler>();
+    auto waiting            = twoFrames->Start([]() -> Async<void> { co_await TwoFrameWait(1e9); });
+    auto text               = twoFrames->Start([]() -> Async<std::string> {
+        co_await TwoFrameWait();
+        co_return std::string(100, 'x');
+    });
+    assert(waiting.IsValid() && text.IsValid());
+    twoFrames->Update();
+    assert(text.GetState() == AsyncState::Succeed);
+    assert(text.TakeResult().value() == std::string(100, 'x'));
+    assert(waiting.IsRunning());
+
+    std::cout << "TestFixedCapacity passed\n";
+}
+
+void TestStartMany()
+{
+    Scheduler sched;
+    auto      Twice = [](int n) -> Async<int> {
+        co_await Wait();
+        co_return n * 2;
+    };
+
+    const std::vector<int> args = {1, 2, 3, 4};
+    auto                   handles = sched.StartMany(Twice, args);
+    assert(handles.size() == args.size());
+
+    // The output iterator variant, with a range which isn't sized.
+    std::vector<Handle<int>> more;
+    sched.StartMany(Twice, std::views::iota(10) | std::views::take_while([](int n) { return n < 13; }), std::back_inserter(more));
+    assert(more.size() == 3);
+
+    sched.Update();
+    for (size_t i = 0; i < args.size(); ++i)
+        assert(handles[i].TakeResult().value() == args[i] * 2);
+    for (int i = 0; i < 3; ++i)
+        assert(more[i].TakeResult().value() == (10 + i) * 2);
+
+    // A full fixed capacity scheduler writes invalid handles.
+    auto fixed = std::make_unique<FixedScheduler>();
+    auto fixedHandles = fixed->StartMany(FixedNested, std::views::iota(1, 11));
+    assert(fixedHandles.size() == 10);
+    assert(std::count_if(fixedHandles.begin(), fixedHandles.end(), [](const Handle<int>& h) { return h.IsValid(); }) == 8);
+
+    std::cout << "TestStartMany passed\n";
+}
+
 // Stress test: spawn many coroutines computing Fibonacci and cancel some
-void StressTest(size_t count)
+// SameDelay: all waits use the same delay, so lots of coroutines wait for the same deadline.
+template <typename Config = DefaultSchedulerConfig, bool SameDelay = false>
+void StressTest(size_t count, const char* name = "")
 {
+    using SchedulerT = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+    using WaitT      = WaitBP<internal::PresetUpdateType, internal::PresetTimeType, Config>;
+
     double simTime = 0.0f;
 
-    Scheduler sched;
+    SchedulerT sched;
     sched.SetCustomTimer(internal::PresetTimeType::Realtime, [&]() { return simTime; });
 
     std::vector<Handle<int>> handles;
@@ -955,7 +2155,7 @@ void StressTest(size_t count)
         const auto fabi = Rand::Int(3, 11);
 
         auto h = sched.Start([&](uint32_t fabIndex) -> Async<int> {
-            int rootValue = co_await FibCoro(fabIndex);
+            int rootValue = co_await FibCoro<WaitT, SameDelay>(fabIndex);
             finished++;
             co_return rootValue;
         },
@@ -988,10 +2188,10 @@ void StressTest(size_t count)
         simTime += 0.0166666666f;
     }
 
-    std::cout << "max update time " << maxUpdateTime << "ms" << std::endl;
+    std::cout << name << "max update time " << maxUpdateTime << "ms" << std::endl;
 
     auto end = std::chrono::high_resolution_clock::now();
-    std::cout << "stress test time "
+    std::cout << name << "stress test time "
               << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0 << "ms" << std::endl;
 
     assert(finished == count / 2 && "Scheduler did not finish in time");
@@ -1014,29 +2214,409 @@ void StressTest(size_t count)
         assert(r.value() == fibResults[fabi]);
     }
 
-    std::cout << "TestStress(" << count << ") passed\n";
+    std::cout << name << "TestStress(" << count << ") passed\n";
+}
+
+Async<int> NestedFrames(int depth)
+{
+    if (depth == 0)
+    {
+        co_await Wait();
+        co_return 0;
+    }
+    co_return 1 + co_await NestedFrames(depth - 1);
+}
+
+// Once warmed up, frames of the same shape are reused from the pool instead of global new.
+void TestFramePool()
+{
+    Scheduler sched;
+    auto      run = [&]() {
+        std::vector<Handle<int>> handles;
+        for (int i = 0; i < 16; ++i)
+            handles.push_back(sched.Start(NestedFrames, 8));
+        sched.Update();
+        for (auto& handle : handles)
+            assert(handle.TakeResult().value() == 8);
+    };
+
+    run();
+    const size_t upstream = FramePool::GetStats().upstreamAllocations;
+    run();
+    assert(FramePool::GetStats().upstreamAllocations == upstream);
+
+    FramePool::Trim();
+    assert(FramePool::GetStats().cachedBytes == 0);
+
+    FramePool::Reserve(200, 32);
+    assert(FramePool::GetStats().cachedBlocks == 32);
+    run();
+    FramePool::Trim(1024);
+    assert(FramePool::GetStats().cachedBytes <= 1024);
+
+    std::cout << "TestFramePool passed\n";
+}
+
+// Frames of finished roots are freed while their handles still hold the results.
+void TestEagerFrameRelease()
+{
+    Scheduler sched;
+    FramePool::Trim();
+
+    std::vector<Handle<int>> small;
+    for (int i = 0; i < 32; ++i)
+        small.push_back(sched.Start(NestedFrames, 2));
+    auto big    = sched.Start(MakeBigResult, 9);
+    auto failed = sched.Start([]() -> Async<void> {
+        co_await Wait();
+        throw std::runtime_error("failed");
+    });
+
+    sched.Update();
+    sched.Update();
+    assert(FramePool::GetStats().cachedBlocks >= 32 * 3);
+
+    for (auto& handle : small)
+    {
+        assert(handle.GetState() == AsyncState::Succeed);
+        assert(handle.TakeResult().value() == 2);
+        assert(!handle.TakeResult().has_value());
+    }
+    assert(*big.TakeResult().value().ptr == 9);
+
+    bool caught = false;
+    try
+    {
+        failed.TakeResult();
+    }
+    catch (const std::runtime_error&)
+    {
+        caught = true;
+    }
+    assert(caught && failed.GetState() == AsyncState::Failed);
+
+    std::cout << "TestEagerFrameRelease passed\n";
+}
+
+Async<int> SuspendingChild()
+{
+    co_await Wait();
+    co_return 1;
+}
+
+// With clang's coro_await_elidable at -O2, the frame of an Async awaited right away lives in its
+// caller's frame: only the root takes a frame from the pool. Without it the child takes one too.
+void TestAwaitElision()
+{
+    Scheduler sched;
+    auto      run = [&]() {
+        const size_t cached = FramePool::GetStats().cachedBlocks;
+        auto         handle = sched.Start([]() -> Async<int> { co_return co_await SuspendingChild(); });
+        const size_t taken  = cached - FramePool::GetStats().cachedBlocks;
+        sched.Update();
+        assert(handle.TakeResult().value() == 1);
+        return taken;
+    };
+
+    run(); // Warm up the pool.
+    const size_t taken = run();
+#if defined(TOKORO_HAS_CORO_AWAIT_ELIDABLE) && defined(__OPTIMIZE__)
+    assert(taken == 1);
+    std::cout << "TestAwaitElision passed\n";
+#else
+    assert(taken == 2);
+    std::cout << "TestAwaitElision passed (elision not available, not checked)\n";
+#endif
+}
+
+Async<int> ScopedWork(int depth)
+{
+    co_await Wait();
+    int result = co_await NestedFrames(depth);
+    co_await Wait(1000.0);
+    co_return result;
+}
+
+// Frames of scoped coroutines and their children, created at start or later, come from the arena.
+void TestCoroScope()
+{
+    Scheduler sched;
+    FramePool::Trim();
+    const size_t upstream = FramePool::GetStats().upstreamAllocations;
+
+    std::vector<Handle<int>> handles;
+    Handle<int>              unscoped;
+    {
+        CoroScope scope(sched, 1024);
+        for (int i = 0; i < 64; ++i)
+            handles.push_back(scope.Start(ScopedWork, 4));
+
+        for (int i = 0; i < 4; ++i)
+            sched.Update();
+        assert(FramePool::GetStats().upstreamAllocations == upstream);
+        assert(FramePool::GetStats().cachedBytes == 0);
+        for (auto& handle : handles)
+            assert(handle.IsRunning());
+
+        // Scheduler::Start from a scoped coroutine isn't part of the scope.
+        auto starter = scope.Start([&]() -> Async<void> {
+            unscoped = sched.Start(NestedFrames, 2);
+            co_return;
+        });
+        assert(starter.GetState() == AsyncState::Succeed);
+        assert(FramePool::GetStats().upstreamAllocations > upstream);
+
+        scope.Stop();
+        for (auto& handle : handles)
+        {
+            assert(handle.GetState() == AsyncState::Stopped);
+            assert(!handle.TakeResult().has_value());
+        }
+
+        // Reusable after Stop.
+        handles.push_back(scope.Start(ScopedWork, 2));
+        sched.Update();
+    }
+    assert(handles.back().GetState() == AsyncState::Stopped);
+
+    for (int i = 0; i < 4; ++i)
+        sched.Update();
+    assert(unscoped.TakeResult().value() == 2);
+
+    // The arena and the ids come from the scheduler's resource, not the global heap.
+    static std::byte                    buffer[1 << 18];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    CountingResource                    resource(&arena);
+    {
+        Scheduler    resourceSched(&resource);
+        const size_t allocations = gAllocations;
+        {
+            CoroScope scope(resourceSched, 1024);
+            for (int i = 0; i < 16; ++i)
+                scope.Start(ScopedWork, 2).Forget();
+            resourceSched.Update();
+        }
+        assert(gAllocations == allocations);
+        assert(resource.allocations > 0);
+    }
+    assert(resource.bytesInUse == 0);
+
+    std::cout << "TestCoroScope passed\n";
+}
+
+// Config to benchmark the original std::multiset time queue against the default one.
+struct MultisetQueueConfig : DefaultSchedulerConfig
+{
+    template <typename T, typename TimeT>
+    using TimeQueue = internal::MultisetTimeQueue<T, TimeT>;
+};
+
+struct DaryHeapConfig : DefaultSchedulerConfig
+{
+    template <typename T, typename TimeT>
+    using TimeQueue = internal::DaryHeapTimeQueue<T, TimeT>;
+};
+
+struct TimingWheelConfig : DefaultSchedulerConfig
+{
+    template <typename T, typename TimeT>
+    using TimeQueue = internal::TimingWheelTimeQueue<T, TimeT>;
+};
+
+// Keep count timers alive in a queue: every update pops the due ones and adds them back with a new random delay.
+template <template <typename, typename> class Queue>
+void BenchmarkTimeQueue(size_t count, const char* name)
+{
+    struct Item
+    {
+        typename Queue<Item*, double>::Hook hook;
+    };
+
+    Rand::SetSeed(1);
+    Queue<Item*, double> queue;
+    std::vector<Item> items(count);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (Item& item : items)
+        queue.AddTimed(item.hook, Rand::Float(0.0f, 10.0f), &item);
+
+    size_t popped = 0;
+    double time   = 0;
+    for (int frame = 0; frame < 300; ++frame)
+    {
+        time += 0.0166666;
+        queue.SetupUpdate(time);
+        while (queue.CheckUpdate())
+        {
+            Item* item = queue.Pop();
+            queue.AddTimed(item->hook, time + Rand::Float(0.0f, 10.0f), item);
+            ++popped;
+        }
+    }
+    for (Item& item : items)
+        queue.Remove(item.hook);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "TimeQueue benchmark " << name << "(" << count << " timers, " << popped << " expired): "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0 << "ms" << std::endl;
+}
+
+// A wave of coroutines started one by one, against one StartMany call.
+void BenchmarkStartMany(size_t count, int rounds)
+{
+    auto Behavior = [](int n) -> Async<void> {
+        co_await Wait(1.0 + n % 7);
+    };
+
+    std::vector<int> args(count);
+    for (size_t i = 0; i < count; ++i)
+        args[i] = static_cast<int>(i);
+
+    // Each start runs the coroutine to its wait. Round 0 warms up the frame pool and isn't counted.
+    std::chrono::duration<double> loopTime{}, batchTime{};
+    for (int round = 0; round <= rounds; ++round)
+    {
+        {
+            Scheduler                 sched;
+            std::vector<Handle<void>> handles;
+            handles.reserve(count);
+            auto start = std::chrono::steady_clock::now();
+            for (int n : args)
+                handles.push_back(sched.Start(Behavior, n));
+            if (round > 0)
+                loopTime += std::chrono::steady_clock::now() - start;
+        }
+        {
+            Scheduler                 sched;
+            std::vector<Handle<void>> handles;
+            handles.reserve(count);
+            auto start = std::chrono::steady_clock::now();
+            sched.StartMany(Behavior, args, std::back_inserter(handles));
+            if (round > 0)
+                batchTime += std::chrono::steady_clock::now() - start;
+        }
+    }
+
+    std::cout << "Start benchmark (" << count << " coroutines, " << rounds << " rounds): loop of Start "
+              << loopTime.count() * 1000 / rounds << "ms, StartMany " << batchTime.count() * 1000 / rounds << "ms" << std::endl;
+}
+
+void BenchmarkTimeQueues(size_t count)
+{
+    BenchmarkTimeQueue<internal::MultisetTimeQueue>(count, "MultisetTimeQueue");
+    BenchmarkTimeQueue<internal::IntrusiveTimeQueue>(count, "IntrusiveTimeQueue");
+    BenchmarkTimeQueue<internal::TimingWheelTimeQueue>(count, "TimingWheelTimeQueue");
+    BenchmarkTimeQueue<internal::DaryHeapTimeQueue>(count, "DaryHeapTimeQueue<4>");
+    BenchmarkTimeQueue<DaryHeap8Queue>(count, "DaryHeapTimeQueue<8>");
+}
+
+// Per read cost of a timer policy in ns.
+template <typename Timer>
+double BenchmarkClockRead(size_t reads, const char* name)
+{
+    Timer  timer;
+    double sum   = 0;
+    auto   start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < reads; ++i)
+        sum += timer.Now(internal::PresetTimeType::Realtime);
+    auto end = std::chrono::steady_clock::now();
+
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count() / reads;
+    std::cout << "Clock benchmark " << name << ": " << ns << "ns per read" << (sum < 0 ? " " : "") << std::endl;
+    return ns;
+}
+
+// Read cost of the clocks, and how far TscClock drifts from steady_clock over a long run.
+void BenchmarkClocks(size_t reads, double driftSeconds)
+{
+    using TimeType = internal::PresetTimeType;
+    BenchmarkClockRead<SteadyTimer<TimeType>>(reads, "SteadyTimer");
+    BenchmarkClockRead<DynamicTimer<TimeType>>(reads, "DynamicTimer(default)");
+    BenchmarkClockRead<TscTimer<TimeType>>(reads, "TscTimer");
+    BenchmarkClockRead<TscTimer<TimeType, true>>(reads, "TscTimer<Fenced>");
+
+    auto offset = []() { return internal::TscClock::Now() - SteadyTimer<TimeType>::Now(TimeType::Realtime); };
+
+    const double startOffset = offset();
+    const auto   start       = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::duration<double>(driftSeconds))
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    const double drift = offset() - startOffset;
+
+    std::cout << "Clock benchmark TscClock drift from steady_clock over " << driftSeconds << "s: "
+              << drift * 1e6 << "us (" << (internal::TscClock::IsTscUsed() ? "TSC" : "steady_clock fallback") << ")" << std::endl;
 }
 
-int main()
+int main(int argc, char** argv)
 {
     TestSingleAwaitValue();
     TestSingleAwaitVoid();
     TestAllCombinator();
     TestAnyCombinator();
     TestNextFrame();
+    TestNextUpdateOrder();
+    TestWaitFrames();
+    TestTimeSampling<DefaultSchedulerConfig>("[snapshot] ");
+    TestTimeSampling<PreciseTimeConfig>("[precise] ");
+    TestTimerPolicy();
+    TestTscTimer();
     TestStop();
     TestUseHandleAfterSchedulerDestroyed();
+    TestCompactHandle();
+    TestGenerationWrap();
+    TestSpawn();
+    TestHandleInCoroutineTeardown();
     TestStartInCoroutine();
     TestGlobalScheduler();
     TestTmplAnyMove();
     TestCustomUpdateAndTimers();
+    TestStartDeferred();
+    TestIntegerTimeDomain();
+    TestIntegerTimeDomain<TimingWheelConfig>("[timing wheel] ");
+    TestIntegerTimeDomain<DaryHeapConfig>("[d-ary heap] ");
     TestWaitUntilAndWhile();
     TestThrowException();
     TestHandle();
+    TestStartCaptures();
+    TestTypedResults();
+    TestSynchronousCompletion();
     TestMemberCoroutines();
     TestReturnObjLifetime();
 
+    TestTimeQueue<internal::MultisetTimeQueue>("MultisetTimeQueue");
+    TestTimeQueue<internal::IntrusiveTimeQueue>("IntrusiveTimeQueue");
+    TestTimeQueue<internal::TimingWheelTimeQueue>("TimingWheelTimeQueue");
+    TestTimeQueue<internal::DaryHeapTimeQueue>("DaryHeapTimeQueue<4>");
+    TestTimeQueue<DaryHeap8Queue>("DaryHeapTimeQueue<8>");
+    TestTimeQueue<internal::IntrusiveTimeQueue, int64_t>("IntrusiveTimeQueue, int64_t");
+    TestTimeQueue<internal::TimingWheelTimeQueue, int64_t>("TimingWheelTimeQueue, int64_t");
+    TestTimeQueue<DaryHeap8Queue, int64_t>("DaryHeapTimeQueue<8>, int64_t");
+    TestTimingWheelLongDelays();
+
+    TestFramePool();
+    TestEagerFrameRelease();
+    TestAwaitElision();
+    TestCoroScope();
+    TestFixedCapacity();
+    TestStartMany();
+    TestZeroAllocation(1000);
+    TestMemoryResource();
+    TestMemoryResource<MultisetQueueConfig>("[multiset] ");
+    TestMemoryResource<DaryHeapConfig>("[d-ary heap] ");
+    TestZeroAllocation<DaryHeapConfig>(1000, "[d-ary heap] ");
     StressTest(20000);
+    StressTest<MultisetQueueConfig>(20000, "[multiset] ");
+    StressTest<TimingWheelConfig>(20000, "[timing wheel] ");
+    StressTest<DaryHeapConfig>(20000, "[d-ary heap] ");
+    StressTest<DefaultSchedulerConfig, true>(20000, "[same delay] ");
+    StressTest<MultisetQueueConfig, true>(20000, "[same delay][multiset] ");
+
+    BenchmarkTimeQueues(1000000);
+    BenchmarkStartMany(10000, 10);
+
+    // Takes seconds for the drift measurement, so only on request.
+    if (argc > 1 && std::string_view(argv[1]) == "--clock-benchmark")
+        BenchmarkClocks(10000000, 2);
 
     std::cout << "All tests passed successfully." << std::endl;
     return 0;
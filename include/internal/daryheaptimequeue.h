@@ -0,0 +1,373 @@
+#pragma once
+
+#include "defines.h"
+
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TOKORO_DARY_HEAP_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TOKORO_DARY_HEAP_SSE2 1
+#endif
+
+namespace tokoro::internal
+{
+
+// Time queue on a d-ary heap stored as struct of arrays. The heap only holds the keys
+// (times in one contiguous array, add orders in another) and a slot index per entry.
+// Slots are stable indices, owned by the Hooks, so Remove() can find the heap position.
+// Picking the min child reads Arity consecutive times, done with AVX/SSE2 when TimeT is double.
+//
+// Compared with tree based queues there's no pointer chasing, a sift touches a few cache lines
+// per level and the heap is log4/log8 deep. The arrays grow on demand and never shrink.
+template <typename T, typename TimeT = double, uint32_t Arity = 4>
+class DaryHeapTimeQueue
+{
+    static_assert(Arity == 4 || Arity == 8, "DaryHeapTimeQueue supports 4-ary and 8-ary heaps.");
+
+private:
+    static constexpr uint32_t NoSlot       = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t DeferredFlag = 1u << 31;
+
+public:
+    class Hook
+    {
+    public:
+        bool IsLinked() const noexcept
+        {
+            return mSlot != NoSlot;
+        }
+
+    private:
+        friend class DaryHeapTimeQueue;
+
+        uint32_t mSlot = NoSlot;
+        T        mValue{};
+    };
+
+    explicit DaryHeapTimeQueue(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : mTimes(resource), mOrders(resource), mHeapSlots(resource), mPositions(resource), mHooks(resource), mDeferred(resource)
+    {
+        mTimes.assign(Arity, Infinity);
+    }
+
+    void Clear()
+    {
+        mTimes.assign(Arity, Infinity);
+        mOrders.clear();
+        mHeapSlots.clear();
+        mDeferred.clear();
+        mPositions.clear();
+        mHooks.clear();
+        mFreeSlot   = NoSlot;
+        mAddOrder   = 0;
+        mAddFrame   = 0;
+        mCurExeTime = std::numeric_limits<TimeT>::lowest();
+    }
+
+    // Make room for count pending waits, so adding up to count doesn't allocate.
+    void Reserve(size_t count)
+    {
+        mTimes.reserve(count + Arity);
+        mOrders.reserve(count);
+        mHeapSlots.reserve(count);
+        mPositions.reserve(count);
+        mHooks.reserve(count);
+        mDeferred.reserve(count);
+    }
+
+    void AddTimed(Hook& hook, const TimeT time, const T& e)
+    {
+        assert(!hook.IsLinked());
+
+        hook.mValue = e;
+        hook.mSlot  = AllocSlot(&hook);
+
+        const uint64_t order = (static_cast<uint64_t>(mAddOrder++) << 32) | mAddFrame;
+        if (time <= mCurExeTime)
+        {
+            mPositions[hook.mSlot] = DeferredFlag | static_cast<uint32_t>(mDeferred.size());
+            mDeferred.push_back({time, order, hook.mSlot});
+        }
+        else
+        {
+            Push(time, order, hook.mSlot);
+        }
+    }
+
+    void Remove(Hook& hook)
+    {
+        assert(hook.IsLinked());
+
+        const uint32_t position = mPositions[hook.mSlot];
+        if (position & DeferredFlag)
+        {
+            const uint32_t index = position & ~DeferredFlag;
+            mDeferred[index]     = mDeferred.back();
+            mPositions[mDeferred[index].slot] = DeferredFlag | index;
+            mDeferred.pop_back();
+        }
+        else
+        {
+            Erase(position);
+        }
+
+        FreeSlot(hook.mSlot);
+        hook.mSlot = NoSlot;
+    }
+
+    T Pop()
+    {
+        // User should CheckUpdate() before Pop()
+        assert(!mHeapSlots.empty());
+
+        const uint32_t slot = mHeapSlots[0];
+        Hook*          hook = mHooks[slot];
+        Erase(0);
+
+        FreeSlot(slot);
+        hook->mSlot = NoSlot;
+        return hook->mValue;
+    }
+
+    bool CheckUpdate() const noexcept
+    {
+        return !mHeapSlots.empty() && mTimes[0] <= mCurExeTime;
+    }
+
+    void SetupUpdate(TimeT exeTime)
+    {
+        mAddFrame++;
+        mAddOrder   = 0;
+        mCurExeTime = exeTime;
+
+        for (const Deferred& d : mDeferred)
+            Push(d.time, d.order, d.slot);
+        mDeferred.clear();
+    }
+
+private:
+    // Padding time, larger than any real one.
+    static constexpr TimeT Infinity = std::numeric_limits<TimeT>::has_infinity ? std::numeric_limits<TimeT>::infinity()
+                                                                                : std::numeric_limits<TimeT>::max();
+
+    struct Deferred
+    {
+        TimeT    time;
+        uint64_t order;
+        uint32_t slot;
+    };
+
+    uint32_t Size() const noexcept
+    {
+        return static_cast<uint32_t>(mHeapSlots.size());
+    }
+
+    uint32_t AllocSlot(Hook* hook)
+    {
+        if (mFreeSlot != NoSlot)
+        {
+            const uint32_t slot = mFreeSlot;
+            mFreeSlot           = mPositions[slot];
+            mHooks[slot]        = hook;
+            return slot;
+        }
+
+        mPositions.push_back(0);
+        mHooks.push_back(hook);
+        return static_cast<uint32_t>(mHooks.size() - 1);
+    }
+
+    // Free slots are chained through mPositions.
+    void FreeSlot(uint32_t slot) noexcept
+    {
+        mPositions[slot] = mFreeSlot;
+        mHooks[slot]     = nullptr;
+        mFreeSlot        = slot;
+    }
+
+    bool Less(uint32_t a, uint32_t b) const noexcept
+    {
+        if (mTimes[a] != mTimes[b])
+            return mTimes[a] < mTimes[b];
+        else
+            return mOrders[a] < mOrders[b];
+    }
+
+    void Set(uint32_t position, TimeT time, uint64_t order, uint32_t slot) noexcept
+    {
+        mTimes[position]     = time;
+        mOrders[position]    = order;
+        mHeapSlots[position] = slot;
+        mPositions[slot]     = position;
+    }
+
+    void Move(uint32_t from, uint32_t to) noexcept
+    {
+        Set(to, mTimes[from], mOrders[from], mHeapSlots[from]);
+    }
+
+    void Push(TimeT time, uint64_t order, uint32_t slot)
+    {
+        // mTimes always keeps Arity infinite paddings after the heap, so the last node can be
+        // compared as if it had all children.
+        mTimes.push_back(Infinity);
+        mOrders.push_back(0);
+        mHeapSlots.push_back(0);
+
+        SiftUp(Size() - 1, time, order, slot);
+    }
+
+    void Erase(uint32_t position) noexcept
+    {
+        const uint32_t last = Size() - 1;
+
+        const TimeT    time  = mTimes[last];
+        const uint64_t order = mOrders[last];
+        const uint32_t slot  = mHeapSlots[last];
+
+        mTimes[last] = Infinity;
+        mTimes.pop_back();
+        mOrders.pop_back();
+        mHeapSlots.pop_back();
+
+        if (position == last)
+            return;
+
+        // Put the last entry at the hole, then move it towards the right direction.
+        if (position > 0 && (time < mTimes[Parent(position)] || (time == mTimes[Parent(position)] && order < mOrders[Parent(position)])))
+            SiftUp(position, time, order, slot);
+        else
+            SiftDown(position, time, order, slot);
+    }
+
+    static uint32_t Parent(uint32_t position) noexcept
+    {
+        return (position - 1) / Arity;
+    }
+
+    void SiftUp(uint32_t hole, TimeT time, uint64_t order, uint32_t slot) noexcept
+    {
+        while (hole > 0)
+        {
+            const uint32_t parent = Parent(hole);
+            if (time > mTimes[parent] || (time == mTimes[parent] && order > mOrders[parent]))
+                break;
+
+            Move(parent, hole);
+            hole = parent;
+        }
+        Set(hole, time, order, slot);
+    }
+
+    void SiftDown(uint32_t hole, TimeT time, uint64_t order, uint32_t slot) noexcept
+    {
+        const uint32_t size = Size();
+        while (true)
+        {
+            const uint32_t first = hole * Arity + 1;
+            if (first >= size)
+                break;
+
+            const uint32_t child = MinChild(first);
+            if (time < mTimes[child] || (time == mTimes[child] && order < mOrders[child]))
+                break;
+
+            Move(child, hole);
+            hole = child;
+        }
+        Set(hole, time, order, slot);
+    }
+
+    // Index of the smallest of the Arity children starting at first.
+    // Missing children are infinite paddings, which never win unless all are missing.
+    uint32_t MinChild(uint32_t first) const noexcept
+    {
+        const TimeT* times = mTimes.data() + first;
+        uint32_t     mask  = 0;
+
+        if constexpr (std::is_same_v<TimeT, double>)
+            mask = MinMaskSimd(times);
+        else
+            mask = MinMaskScalar(times);
+
+        uint32_t best = first + static_cast<uint32_t>(std::countr_zero(mask));
+        mask &= mask - 1;
+
+        // Rare: equal times, break the tie with add order. Paddings are out of the heap.
+        const uint32_t size = Size();
+        while (mask != 0)
+        {
+            const uint32_t other = first + static_cast<uint32_t>(std::countr_zero(mask));
+            mask &= mask - 1;
+            if (other < size && mOrders[other] < mOrders[best])
+                best = other;
+        }
+        return best;
+    }
+
+    // Bit i set if times[i] is the minimum of the Arity times.
+    static uint32_t MinMaskScalar(const TimeT* times) noexcept
+    {
+        TimeT minTime = times[0];
+        for (uint32_t i = 1; i < Arity; ++i)
+            minTime = times[i] < minTime ? times[i] : minTime;
+
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < Arity; ++i)
+            mask |= static_cast<uint32_t>(times[i] == minTime) << i;
+        return mask;
+    }
+
+    static uint32_t MinMaskSimd(const double* times) noexcept
+    {
+        uint32_t mask = 0;
+#if defined(TOKORO_DARY_HEAP_AVX)
+        __m256d minV = _mm256_loadu_pd(times);
+        if constexpr (Arity == 8)
+            minV = _mm256_min_pd(minV, _mm256_loadu_pd(times + 4));
+        minV = _mm256_min_pd(minV, _mm256_permute2f128_pd(minV, minV, 1));
+        minV = _mm256_min_pd(minV, _mm256_permute_pd(minV, 0b0101));
+
+        mask = static_cast<uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(times), minV, _CMP_EQ_OQ)));
+        if constexpr (Arity == 8)
+            mask |= static_cast<uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(times + 4), minV, _CMP_EQ_OQ))) << 4;
+#elif defined(TOKORO_DARY_HEAP_SSE2)
+        __m128d minV = _mm_min_pd(_mm_loadu_pd(times), _mm_loadu_pd(times + 2));
+        if constexpr (Arity == 8)
+            minV = _mm_min_pd(minV, _mm_min_pd(_mm_loadu_pd(times + 4), _mm_loadu_pd(times + 6)));
+        minV = _mm_min_pd(minV, _mm_shuffle_pd(minV, minV, 1));
+
+        for (uint32_t i = 0; i < Arity; i += 2)
+            mask |= static_cast<uint32_t>(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(times + i), minV))) << i;
+#else
+        mask = MinMaskScalar(times);
+#endif
+        return mask;
+    }
+
+    // Heap, by position
+    std::pmr::vector<TimeT>    mTimes; // Size() + Arity, the tail is padded with Infinity.
+    std::pmr::vector<uint64_t> mOrders;
+    std::pmr::vector<uint32_t> mHeapSlots;
+
+    // By slot
+    std::pmr::vector<uint32_t> mPositions; // Heap position, DeferredFlag | index in mDeferred, or next free slot.
+    std::pmr::vector<Hook*>    mHooks;
+    uint32_t                   mFreeSlot = NoSlot;
+
+    std::pmr::vector<Deferred> mDeferred;
+    uint32_t                   mAddOrder   = 0;
+    uint32_t                   mAddFrame   = 0;
+    TimeT                      mCurExeTime = std::numeric_limits<TimeT>::lowest();
+};
+
+} // namespace tokoro::internal
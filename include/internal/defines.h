@@ -2,8 +2,22 @@
 
 #include <coroutine>
 #include <cstdint>
+#include <functional>
+#include <type_traits>
 #include <variant>
 
+// Marks Async as elidable when awaited right away: clang can then allocate the frame of a nested
+// coroutine inside the frame of its caller (HALO), skipping operator new and the FramePool.
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::coro_await_elidable)
+#define TOKORO_CORO_AWAIT_ELIDABLE [[clang::coro_await_elidable]]
+#define TOKORO_HAS_CORO_AWAIT_ELIDABLE 1
+#endif
+#endif
+#if !defined(TOKORO_CORO_AWAIT_ELIDABLE)
+#define TOKORO_CORO_AWAIT_ELIDABLE
+#endif
+
 namespace tokoro::internal
 {
 
@@ -15,9 +29,11 @@ public:
     virtual ~CoroAwaiterBase() = default;
 };
 
-// map void to std::monostate
+// map void to std::monostate, and T& to std::reference_wrapper<T>
 template <typename T>
-using RetConvert = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+using RetConvert = std::conditional_t<std::is_void_v<T>,
+                                      std::monostate,
+                                      std::conditional_t<std::is_reference_v<T>, std::reference_wrapper<std::remove_reference_t<T>>, T>>;
 
 enum class PresetUpdateType : int
 {
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "defines.h"
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+namespace tokoro::internal
+{
+
+// Memory resource over BlockCount blocks of BlockSize bytes stored in the object itself.
+// Allocation and deallocation pop and push a free list, nothing ever goes to the heap.
+// Requests larger than a block, or made when all blocks are in use, throw std::bad_alloc.
+template <size_t BlockSize, size_t BlockCount>
+class FixedBlockResource : public std::pmr::memory_resource
+{
+public:
+    static constexpr size_t Alignment  = alignof(std::max_align_t);
+    static constexpr size_t StoredSize = (BlockSize + Alignment - 1) / Alignment * Alignment;
+
+    static_assert(BlockSize >= sizeof(void*) && BlockCount > 0);
+
+    FixedBlockResource() noexcept
+    {
+        for (size_t index = BlockCount; index-- > 0;)
+        {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(mBlocks + index * StoredSize);
+            block->next      = mFreeHead;
+            mFreeHead        = block;
+        }
+    }
+
+    FixedBlockResource(const FixedBlockResource&)            = delete;
+    FixedBlockResource& operator=(const FixedBlockResource&) = delete;
+
+    bool Full() const noexcept
+    {
+        return mFreeHead == nullptr;
+    }
+
+    size_t UsedBlocks() const noexcept
+    {
+        return mUsedBlocks;
+    }
+
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if (bytes > BlockSize || alignment > Alignment || mFreeHead == nullptr)
+            throw std::bad_alloc();
+
+        FreeBlock* block = mFreeHead;
+        mFreeHead        = block->next;
+        ++mUsedBlocks;
+        return block;
+    }
+
+    void do_deallocate(void* ptr, size_t /*bytes*/, size_t /*alignment*/) override
+    {
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next      = mFreeHead;
+        mFreeHead        = block;
+        --mUsedBlocks;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    alignas(Alignment) std::byte mBlocks[StoredSize * BlockCount];
+    FreeBlock* mFreeHead   = nullptr;
+    size_t     mUsedBlocks = 0;
+};
+
+} // namespace tokoro::internal
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "defines.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace tokoro::internal
+{
+
+// Per thread size-class cache of coroutine frames, used by PromiseBase::operator new/delete.
+// Sizes are rounded up to ClassStep, a freed frame goes to the free list of its class and is
+// reused by the next frame of that class. So a steady state of starting and finishing
+// coroutines, including deep chains of nested ones, doesn't go to malloc.
+// Frames larger than MaxPooledSize go to global operator new directly.
+//
+// Each block is a plain global operator new allocation. Trim() returns cached blocks, and a
+// frame freed on another thread, or after this thread's pool is destroyed, is still valid.
+class FramePool
+{
+public:
+    static constexpr size_t ClassStep     = 64;
+    static constexpr size_t MaxPooledSize = 4096;
+
+    struct Stats
+    {
+        size_t upstreamAllocations = 0; // Blocks taken from global operator new.
+        size_t cachedBlocks        = 0;
+        size_t cachedBytes         = 0;
+    };
+
+    static void* Allocate(size_t size)
+    {
+        FramePool* pool = Local();
+        if (size > MaxPooledSize || pool == nullptr)
+            return ::operator new(size);
+
+        const size_t index = ClassIndex(size);
+        FreeBlock*   block = pool->mFreeLists[index];
+        if (block != nullptr)
+        {
+            pool->mFreeLists[index] = block->next;
+            --pool->mCachedBlocks[index];
+            return block;
+        }
+
+        ++pool->mUpstreamAllocations;
+        return ::operator new(ClassSize(index));
+    }
+
+    static void Deallocate(void* ptr, size_t size) noexcept
+    {
+        FramePool* pool = Local();
+        if (size > MaxPooledSize || pool == nullptr)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        const size_t index      = ClassIndex(size);
+        FreeBlock*   block      = static_cast<FreeBlock*>(ptr);
+        block->next             = pool->mFreeLists[index];
+        pool->mFreeLists[index] = block;
+        ++pool->mCachedBlocks[index];
+    }
+
+    // Make sure count frames of frameSize bytes are cached, e.g. before a level starts.
+    static void Reserve(size_t frameSize, size_t count)
+    {
+        FramePool* pool = Local();
+        if (frameSize > MaxPooledSize || pool == nullptr)
+            return;
+
+        const size_t index = ClassIndex(frameSize);
+        while (pool->mCachedBlocks[index] < count)
+        {
+            ++pool->mUpstreamAllocations;
+            Deallocate(::operator new(ClassSize(index)), frameSize);
+        }
+    }
+
+    // Return cached frames to global operator delete until at most keepBytes are cached.
+    // Larger classes go first.
+    static void Trim(size_t keepBytes = 0) noexcept
+    {
+        FramePool* pool = Local();
+        if (pool == nullptr)
+            return;
+
+        size_t cached = GetStats().cachedBytes;
+        for (size_t index = ClassCount; index-- > 0 && cached > keepBytes;)
+        {
+            while (pool->mFreeLists[index] != nullptr && cached > keepBytes)
+            {
+                FreeBlock* block        = pool->mFreeLists[index];
+                pool->mFreeLists[index] = block->next;
+                --pool->mCachedBlocks[index];
+                cached -= ClassSize(index);
+                ::operator delete(block);
+            }
+        }
+    }
+
+    static Stats GetStats() noexcept
+    {
+        Stats      stats;
+        FramePool* pool = Local();
+        if (pool == nullptr)
+            return stats;
+
+        stats.upstreamAllocations = pool->mUpstreamAllocations;
+        for (size_t index = 0; index < ClassCount; ++index)
+        {
+            stats.cachedBlocks += pool->mCachedBlocks[index];
+            stats.cachedBytes += pool->mCachedBlocks[index] * ClassSize(index);
+        }
+        return stats;
+    }
+
+    ~FramePool()
+    {
+        Trim();
+        tDestroyed = true;
+    }
+
+private:
+    static constexpr size_t ClassCount = MaxPooledSize / ClassStep;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    static size_t ClassIndex(size_t size) noexcept
+    {
+        return size == 0 ? 0 : (size - 1) / ClassStep;
+    }
+
+    static size_t ClassSize(size_t index) noexcept
+    {
+        return (index + 1) * ClassStep;
+    }
+
+    // Null once the pool of this thread is destroyed, frames destroyed later (e.g. by a static
+    // scheduler) bypass it.
+    static FramePool* Local() noexcept
+    {
+        if (tDestroyed)
+            return nullptr;
+
+        thread_local FramePool pool;
+        return &pool;
+    }
+
+    static inline thread_local bool tDestroyed = false;
+
+    std::array<FreeBlock*, ClassCount> mFreeLists{};
+    std::array<size_t, ClassCount>     mCachedBlocks{};
+    size_t                             mUpstreamAllocations = 0;
+};
+
+} // namespace tokoro::internal
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "defines.h"
+#include "framepool.h"
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace tokoro::internal
+{
+
+// Memory resource of the coroutine frames created on this thread right now. Null is the FramePool.
+// It's set around every entry into coroutine code (start and resume), from the resource of the
+// coroutine being entered, so nested coroutines get their frames from the resource of their root.
+inline thread_local std::pmr::memory_resource* tFrameResource = nullptr;
+
+class FrameResourceScope
+{
+public:
+    explicit FrameResourceScope(std::pmr::memory_resource* resource) noexcept
+        : mSaved(tFrameResource)
+    {
+        tFrameResource = resource;
+    }
+
+    ~FrameResourceScope()
+    {
+        tFrameResource = mSaved;
+    }
+
+    FrameResourceScope(const FrameResourceScope&)            = delete;
+    FrameResourceScope& operator=(const FrameResourceScope&) = delete;
+
+private:
+    std::pmr::memory_resource* mSaved;
+};
+
+// Every frame starts with a header recording its resource, so it can be freed to the right place.
+struct alignas(std::max_align_t) FrameHeader
+{
+    std::pmr::memory_resource* resource;
+};
+
+inline void* AllocateFrame(size_t size)
+{
+    std::pmr::memory_resource* resource = tFrameResource;
+
+    const size_t total  = size + sizeof(FrameHeader);
+    void*        memory = resource ? resource->allocate(total, alignof(FrameHeader)) : FramePool::Allocate(total);
+
+    FrameHeader* header = static_cast<FrameHeader*>(memory);
+    header->resource    = resource;
+    return header + 1;
+}
+
+// Lets the one destroying a frame keep its memory, e.g. for the frame's result, see ResultSlot.
+// While set, DeallocateFrame of that frame records its size instead of freeing it. The block is
+// freed later by DeallocateFrame(frame, size).
+struct KeptFrame
+{
+    void*  frame = nullptr; // Frame to keep, as passed to DeallocateFrame.
+    size_t size  = 0;       // Non zero once kept.
+};
+
+inline thread_local KeptFrame* tKeptFrame = nullptr;
+
+inline void DeallocateFrame(void* ptr, size_t size) noexcept
+{
+    if (KeptFrame* kept = tKeptFrame; kept != nullptr && kept->frame == ptr)
+    {
+        kept->size = size;
+        return;
+    }
+
+    FrameHeader*               header   = static_cast<FrameHeader*>(ptr) - 1;
+    std::pmr::memory_resource* resource = header->resource;
+
+    const size_t total = size + sizeof(FrameHeader);
+    if (resource)
+        resource->deallocate(header, total, alignof(FrameHeader));
+    else
+        FramePool::Deallocate(header, total);
+}
+
+} // namespace tokoro::internal
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cassert>
+
+namespace tokoro::internal
+{
+
+// Node of IntrusiveList. Types stored in the list derive from it.
+struct ListHook
+{
+    ListHook* mListPrev = nullptr;
+    ListHook* mListNext = nullptr;
+};
+
+// Minimal doubly linked FIFO list of ListHooks. Never allocates.
+// The list does not track membership, users need to know which list a node is in.
+class IntrusiveList
+{
+public:
+    bool Empty() const noexcept
+    {
+        return mHead == nullptr;
+    }
+
+    ListHook* Front() const noexcept
+    {
+        return mHead;
+    }
+
+    void PushBack(ListHook* node) noexcept
+    {
+        node->mListPrev = mTail;
+        node->mListNext = nullptr;
+        if (mTail)
+            mTail->mListNext = node;
+        else
+            mHead = node;
+        mTail = node;
+    }
+
+    void Erase(ListHook* node) noexcept
+    {
+        if (node->mListPrev)
+            node->mListPrev->mListNext = node->mListNext;
+        else
+            mHead = node->mListNext;
+
+        if (node->mListNext)
+            node->mListNext->mListPrev = node->mListPrev;
+        else
+            mTail = node->mListPrev;
+
+        node->mListPrev = nullptr;
+        node->mListNext = nullptr;
+    }
+
+    ListHook* PopFront() noexcept
+    {
+        assert(mHead != nullptr);
+        ListHook* node = mHead;
+        Erase(node);
+        return node;
+    }
+
+    // Move all nodes of other to the back of this list.
+    void SpliceBack(IntrusiveList& other) noexcept
+    {
+        if (other.Empty())
+            return;
+
+        if (mTail)
+        {
+            mTail->mListNext       = other.mHead;
+            other.mHead->mListPrev = mTail;
+        }
+        else
+        {
+            mHead = other.mHead;
+        }
+        mTail = other.mTail;
+
+        other.mHead = nullptr;
+        other.mTail = nullptr;
+    }
+
+    void Clear() noexcept
+    {
+        mHead = nullptr;
+        mTail = nullptr;
+    }
+
+private:
+    ListHook* mHead = nullptr;
+    ListHook* mTail = nullptr;
+};
+
+} // namespace tokoro::internal
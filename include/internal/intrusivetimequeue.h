@@ -0,0 +1,338 @@
+#pragma once
+
+#include "defines.h"
+
+#include <cassert>
+#include <limits>
+#include <utility>
+
+namespace tokoro::internal
+{
+
+// Allocation free time queue. A pairing heap whose nodes are the Hooks embedded in the queued
+// objects (WaitBP lives in the coroutine frame), so AddTimed/Pop/Remove never touch the heap.
+// Pops by time, then by add order, like MultisetTimeQueue.
+//
+// Waits added in a row with the same time share one bucket: the first one is the heap node, the
+// others join its circular FIFO list. Adding to a bucket is O(1), and popping or removing a bucket
+// member just hands the heap position over to the next member. This collapses the common case of
+// many coroutines started in one frame waiting the same delay.
+//
+// Elements added with a time that is already due in current update go to a deferred heap,
+// which is melded into the main heap by the next SetupUpdate(). That's how this queue keeps
+// "added during an update never run in the same update" without scanning.
+template <typename T, typename TimeT = double>
+class IntrusiveTimeQueue
+{
+public:
+    class Hook
+    {
+    public:
+        bool IsLinked() const noexcept
+        {
+            return mLinked;
+        }
+
+    private:
+        friend class IntrusiveTimeQueue;
+
+        TimeT    mTime       = 0;
+        uint32_t mSeq        = 0;
+        uint32_t mFrame      = 0;
+        Hook*    mChild      = nullptr; // Leftmost child
+        Hook*    mNext       = nullptr; // Right sibling
+        Hook*    mPrev       = nullptr; // Left sibling, or parent for the leftmost child. Null for roots.
+        Hook*    mBucketPrev = nullptr; // Circular bucket list, the heap node is the head.
+        Hook*    mBucketNext = nullptr;
+        T        mValue{};
+        bool     mLinked = false;
+        bool     mInHeap = false; // False for the non-head members of a bucket.
+    };
+
+    void Clear()
+    {
+        mRoot       = nullptr;
+        mDeferred   = nullptr;
+        mLastBucket = nullptr;
+        mAddOrder   = 0;
+        mAddFrame   = 0;
+        mCurExeTime = std::numeric_limits<TimeT>::lowest();
+    }
+
+    void AddTimed(Hook& hook, const TimeT time, const T& e)
+    {
+        assert(!hook.IsLinked());
+
+        hook.mValue  = e;
+        hook.mLinked = true;
+
+        // Same time as last added one, join its bucket. Equal times always go to the same heap.
+        if (mLastBucket != nullptr && mLastBucket->mTime == time)
+        {
+            Hook* head       = mLastBucket;
+            hook.mInHeap     = false;
+            hook.mBucketPrev = head->mBucketPrev;
+            hook.mBucketNext = head;
+
+            head->mBucketPrev->mBucketNext = &hook;
+            head->mBucketPrev              = &hook;
+            return;
+        }
+
+        hook.mTime       = time;
+        hook.mSeq        = mAddOrder++;
+        hook.mFrame      = mAddFrame;
+        hook.mChild      = nullptr;
+        hook.mNext       = nullptr;
+        hook.mPrev       = nullptr;
+        hook.mBucketPrev = &hook;
+        hook.mBucketNext = &hook;
+        hook.mInHeap     = true;
+        mLastBucket      = &hook;
+
+        if (time <= mCurExeTime)
+            mDeferred = mDeferred ? Link(mDeferred, &hook) : &hook;
+        else
+            mRoot = mRoot ? Link(mRoot, &hook) : &hook;
+    }
+
+    void Remove(Hook& hook)
+    {
+        assert(hook.IsLinked());
+
+        if (!hook.mInHeap)
+        {
+            UnlinkFromBucket(hook);
+        }
+        else if (hook.mBucketNext != &hook)
+        {
+            HandOver(hook);
+        }
+        else
+        {
+            RemoveFromHeap(hook);
+        }
+
+        hook.mLinked = false;
+    }
+
+    T Pop()
+    {
+        // User should CheckUpdate() before Pop()
+        assert(mRoot != nullptr);
+
+        Hook* top = mRoot;
+        if (top->mBucketNext != top)
+        {
+            HandOver(*top);
+        }
+        else
+        {
+            mRoot = MergePairs(top->mChild);
+
+            top->mChild = nullptr;
+            if (mLastBucket == top)
+                mLastBucket = nullptr;
+        }
+
+        top->mLinked = false;
+        return top->mValue;
+    }
+
+    bool CheckUpdate() const noexcept
+    {
+        return mRoot != nullptr && mRoot->mTime <= mCurExeTime;
+    }
+
+    void SetupUpdate(TimeT exeTime)
+    {
+        mAddFrame++;
+        mAddOrder   = 0;
+        mCurExeTime = exeTime;
+        // Add order restarts, a new wait can't join older buckets without breaking the pop order.
+        mLastBucket = nullptr;
+
+        if (mDeferred != nullptr)
+        {
+            mRoot     = mRoot ? Link(mRoot, mDeferred) : mDeferred;
+            mDeferred = nullptr;
+        }
+    }
+
+private:
+    static bool Less(const Hook* a, const Hook* b) noexcept
+    {
+        if (a->mTime != b->mTime)
+            return a->mTime < b->mTime;
+        else if (a->mSeq != b->mSeq)
+            return a->mSeq < b->mSeq;
+        else
+            return a->mFrame < b->mFrame;
+    }
+
+    static void UnlinkFromBucket(Hook& hook) noexcept
+    {
+        hook.mBucketPrev->mBucketNext = hook.mBucketNext;
+        hook.mBucketNext->mBucketPrev = hook.mBucketPrev;
+        hook.mBucketPrev              = nullptr;
+        hook.mBucketNext              = nullptr;
+    }
+
+    // Replace a bucket head in the heap by the next member of its bucket. O(1)
+    void HandOver(Hook& head) noexcept
+    {
+        Hook* next = head.mBucketNext;
+        UnlinkFromBucket(head);
+
+        // The next member takes over the key, so the heap order is unchanged.
+        next->mTime   = head.mTime;
+        next->mSeq    = head.mSeq;
+        next->mFrame  = head.mFrame;
+        next->mChild  = head.mChild;
+        next->mNext   = head.mNext;
+        next->mPrev   = head.mPrev;
+        next->mInHeap = true;
+
+        if (next->mChild)
+            next->mChild->mPrev = next;
+        if (next->mNext)
+            next->mNext->mPrev = next;
+
+        if (next->mPrev == nullptr)
+        {
+            if (mRoot == &head)
+                mRoot = next;
+            else
+                mDeferred = next;
+        }
+        else if (next->mPrev->mChild == &head)
+        {
+            next->mPrev->mChild = next;
+        }
+        else
+        {
+            next->mPrev->mNext = next;
+        }
+
+        if (mLastBucket == &head)
+            mLastBucket = next;
+
+        head.mChild = nullptr;
+        head.mNext  = nullptr;
+        head.mPrev  = nullptr;
+    }
+
+    void RemoveFromHeap(Hook& hook) noexcept
+    {
+        Hook* sub   = MergePairs(hook.mChild);
+        hook.mChild = nullptr;
+
+        if (hook.mPrev == nullptr)
+        {
+            assert(&hook == mRoot || &hook == mDeferred);
+            if (&hook == mRoot)
+                mRoot = sub;
+            else
+                mDeferred = sub;
+        }
+        else
+        {
+            // Put merged children at the position of the removed node. Their keys are not
+            // less than the removed one, so the heap order still holds.
+            Hook* prev        = hook.mPrev;
+            Hook* next        = hook.mNext;
+            Hook* replacement = next;
+            if (sub != nullptr)
+            {
+                sub->mPrev  = prev;
+                sub->mNext  = next;
+                replacement = sub;
+                if (next)
+                    next->mPrev = sub;
+            }
+            else if (next)
+            {
+                next->mPrev = prev;
+            }
+
+            if (prev->mChild == &hook)
+                prev->mChild = replacement;
+            else
+                prev->mNext = replacement;
+        }
+
+        if (mLastBucket == &hook)
+            mLastBucket = nullptr;
+
+        hook.mNext = nullptr;
+        hook.mPrev = nullptr;
+    }
+
+    // Link two detached roots, the larger one becomes the leftmost child of the other.
+    static Hook* Link(Hook* a, Hook* b) noexcept
+    {
+        if (Less(b, a))
+            std::swap(a, b);
+
+        b->mPrev = a;
+        b->mNext = a->mChild;
+        if (a->mChild)
+            a->mChild->mPrev = b;
+        a->mChild = b;
+        return a;
+    }
+
+    // Standard two pass merge of a sibling list. Iterative, so a huge list won't blow the stack.
+    static Hook* MergePairs(Hook* first) noexcept
+    {
+        if (first == nullptr)
+            return nullptr;
+
+        // Pass 1: link pairs from left to right, keep results in a reversed list.
+        Hook* paired = nullptr;
+        while (first != nullptr)
+        {
+            Hook* a = first;
+            Hook* b = a->mNext;
+            a->mPrev = nullptr;
+            a->mNext = nullptr;
+            if (b == nullptr)
+            {
+                a->mNext = paired;
+                paired   = a;
+                break;
+            }
+
+            first    = b->mNext;
+            b->mPrev = nullptr;
+            b->mNext = nullptr;
+
+            Hook* linked  = Link(a, b);
+            linked->mNext = paired;
+            paired        = linked;
+        }
+
+        // Pass 2: link from right to left.
+        Hook* result  = paired;
+        paired        = paired->mNext;
+        result->mNext = nullptr;
+        while (paired != nullptr)
+        {
+            Hook* next    = paired->mNext;
+            paired->mNext = nullptr;
+            result        = Link(result, paired);
+            paired        = next;
+        }
+
+        return result;
+    }
+
+    Hook*    mRoot       = nullptr;
+    Hook*    mDeferred   = nullptr;
+    Hook*    mLastBucket = nullptr; // Bucket of the last added wait, for joining.
+    uint32_t mAddOrder   = 0;
+    uint32_t mAddFrame   = 0;
+    TimeT    mCurExeTime = std::numeric_limits<TimeT>::lowest();
+};
+
+} // namespace tokoro::internal
@@ -1,10 +1,11 @@
 #pragma once
 
 #include "defines.h"
+#include "frameresource.h"
 
-#include <any>
 #include <coroutine>
 #include <exception>
+#include <optional>
 
 namespace tokoro
 {
@@ -25,6 +26,10 @@ public:
         void                    await_resume() const noexcept;
     };
 
+    // Coroutine frames come from the current frame resource, the FramePool of current thread by default.
+    static void* operator new(std::size_t size);
+    static void  operator delete(void* ptr, std::size_t size) noexcept;
+
     std::suspend_always initial_suspend() noexcept;
     FinalAwaiter        final_suspend() noexcept;
     void                unhandled_exception();
@@ -36,14 +41,20 @@ public:
 
     void SetParentAwaiter(CoroAwaiterBase* awaiter);
 
+    // Resource this frame was allocated from. Set it back as the current one when resuming.
+    std::pmr::memory_resource* GetFrameResource() const;
+
+    // Move out the exception which finished the coroutine, null if it returned.
+    std::exception_ptr TakeException() noexcept;
+
 protected:
     void RethrowIfAny();
 
-    std::exception_ptr mException;
-    std::any           mReturnValue;
-    uint64_t           mId            = 0;
-    CoroAwaiterBase*   mParentAwaiter = nullptr;
-    void*              mCoroManager   = nullptr;
+    std::exception_ptr         mException;
+    uint64_t                   mId            = 0;
+    CoroAwaiterBase*           mParentAwaiter = nullptr;
+    void*                      mCoroManager   = nullptr;
+    std::pmr::memory_resource* mFrameResource = tFrameResource;
 };
 
 template <typename T>
@@ -56,6 +67,24 @@ public:
     void return_value(T&& val);
     void return_value(const T& val);
     T    TakeResult();
+
+private:
+    std::optional<T> mReturnValue;
+};
+
+// Async<T&> keeps the referred object's address only.
+template <typename T>
+class Promise<T&> : public PromiseBase
+{
+public:
+    using Handle = std::coroutine_handle<Promise<T&>>;
+
+    auto get_return_object() noexcept;
+    void return_value(T& val);
+    T&   TakeResult();
+
+private:
+    T* mReturnValue = nullptr;
 };
 
 template <>
@@ -4,6 +4,7 @@
 // Put them in the .inl file to avoid compiling order issue.(Depend on CoroAwaiterBase and Scheduler)
 
 #include <cassert>
+#include <utility>
 
 namespace tokoro::internal
 {
@@ -44,6 +45,16 @@ inline std::coroutine_handle<> PromiseBase::FinalAwaiter::await_suspend(std::cor
 
 // PromiseBase functions
 //
+inline void* PromiseBase::operator new(std::size_t size)
+{
+    return AllocateFrame(size);
+}
+
+inline void PromiseBase::operator delete(void* ptr, std::size_t size) noexcept
+{
+    DeallocateFrame(ptr, size);
+}
+
 inline std::suspend_always PromiseBase::initial_suspend() noexcept
 {
     return {};
@@ -81,6 +92,16 @@ inline void PromiseBase::SetParentAwaiter(CoroAwaiterBase* awaiter)
     mParentAwaiter = awaiter;
 }
 
+inline std::pmr::memory_resource* PromiseBase::GetFrameResource() const
+{
+    return mFrameResource;
+}
+
+inline std::exception_ptr PromiseBase::TakeException() noexcept
+{
+    return std::exchange(mException, nullptr);
+}
+
 inline void PromiseBase::RethrowIfAny()
 {
     if (this->mException)
@@ -103,20 +124,42 @@ auto Promise<T>::get_return_object() noexcept
 template <typename T>
 void Promise<T>::return_value(T&& val)
 {
-    this->mReturnValue.template emplace<T>(std::forward<T>(val));
+    mReturnValue.emplace(std::move(val));
 }
 
 template <typename T>
 void Promise<T>::return_value(const T& val)
 {
-    this->mReturnValue.template emplace<T>(val);
+    mReturnValue.emplace(val);
 }
 
 template <typename T>
 T Promise<T>::TakeResult()
 {
     RethrowIfAny();
-    return std::move(std::any_cast<T&>(this->mReturnValue));
+    assert(mReturnValue.has_value() && "Result was already taken.");
+    return std::move(*mReturnValue);
+}
+
+// Promise<T&> functions
+//
+template <typename T>
+auto Promise<T&>::get_return_object() noexcept
+{
+    return Handle::from_promise(*this);
+}
+
+template <typename T>
+void Promise<T&>::return_value(T& val)
+{
+    mReturnValue = &val;
+}
+
+template <typename T>
+T& Promise<T&>::TakeResult()
+{
+    RethrowIfAny();
+    return *mReturnValue;
 }
 
 // Promise<void> functions
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "defines.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+
+namespace tokoro::internal
+{
+
+class CoroManager;
+
+// Process wide table of the live schedulers. A Handle names its scheduler by its index here instead
+// of holding a pointer plus a weak_ptr to a live signal. A destroyed scheduler's index finds nothing,
+// or the next scheduler registered at the same index.
+//
+// Stale handles can't reach the next scheduler's coroutines because generations are never reused
+// per index: a scheduler numbers its coroutine slots from the generation after the last one its
+// predecessors at that index used, see SlotMap. An index whose generations run out is retired.
+//
+// Register and Unregister take a lock, they happen once per scheduler. Find is one relaxed load
+// and writes nothing, so handles of schedulers on different threads share no written cache lines.
+// Indices are handed out round robin. Register throws std::length_error when all Capacity indices
+// are in use or retired.
+template <typename Manager, uint32_t IndexBits, uint32_t GenerationBits>
+class BasicSchedulerRegistry
+{
+public:
+    static constexpr uint32_t Capacity      = 1u << IndexBits;
+    static constexpr uint64_t MaxGeneration = (uint64_t{1} << GenerationBits) - 1;
+
+    struct Registration
+    {
+        uint32_t index;
+        uint64_t firstGeneration; // The first one this index hasn't used yet.
+    };
+
+    static Registration Register(Manager* manager)
+    {
+        std::lock_guard lock(sMutex);
+
+        for (uint32_t tried = 0; tried < Capacity; ++tried)
+        {
+            const uint32_t index = (sNextIndex + tried) & IndexMask;
+            Slot&          slot  = sSlots[index];
+            if (slot.manager.load(std::memory_order_relaxed) != nullptr || slot.lastGeneration >= MaxGeneration)
+                continue;
+
+            slot.manager.store(manager, std::memory_order_relaxed);
+            sNextIndex = index + 1;
+            return {index, slot.lastGeneration + 1};
+        }
+        throw std::length_error("No scheduler registry index left, too many tokoro schedulers alive at the same time.");
+    }
+
+    // lastGeneration: the highest generation the scheduler used.
+    static void Unregister(uint32_t index, uint64_t lastGeneration) noexcept
+    {
+        std::lock_guard lock(sMutex);
+
+        Slot& slot = sSlots[index];
+        if (lastGeneration > slot.lastGeneration)
+            slot.lastGeneration = lastGeneration;
+        slot.manager.store(nullptr, std::memory_order_relaxed);
+    }
+
+    // Null if no scheduler is registered at index.
+    static Manager* Find(uint32_t index) noexcept
+    {
+        return sSlots[index & IndexMask].manager.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr uint32_t IndexMask = Capacity - 1;
+
+    // Value initialized, null and 0.
+    struct Slot
+    {
+        std::atomic<Manager*> manager;
+        uint64_t              lastGeneration; // Guarded by sMutex.
+    };
+
+    // Constant initialized, so schedulers with static storage duration can register in any order.
+    static inline std::mutex sMutex;
+    static inline Slot       sSlots[Capacity];
+    static inline uint32_t   sNextIndex = 0;
+};
+
+} // namespace tokoro::internal
@@ -21,8 +21,10 @@ public:
         return false;
     }
 
+    // Returns false when the child finished without suspending, the parent then goes on inline
+    // instead of suspending and being resumed by the child's final awaiter.
     template <typename U>
-    void await_suspend(std::coroutine_handle<Promise<U>> handle) noexcept
+    bool await_suspend(std::coroutine_handle<Promise<U>> handle) noexcept
     {
         mParentHandle = std::coroutine_handle<PromiseBase>::from_address(handle.address());
 
@@ -30,13 +32,17 @@ public:
         promise.SetCoroManager(mParentHandle.promise().GetCoroManager());
         promise.SetParentAwaiter(this);
 
+        mStarting = true;
         mWaitedHandle.resume(); // Kick off child Async<T>
+        mStarting = false;
+
+        return !mWaitedHandle.done();
     }
 
-    T await_resume() const noexcept
+    T await_resume() const
         requires(!std::is_void_v<T>)
     {
-        return std::move(mWaitedHandle.promise().TakeResult());
+        return mWaitedHandle.promise().TakeResult();
     }
 
     void await_resume() const
@@ -47,12 +53,16 @@ public:
 
     std::coroutine_handle<> OnWaitComplete(std::coroutine_handle<> /*unused*/) noexcept override
     {
+        // Finished inside await_suspend(), return to it.
+        if (mStarting)
+            return std::noop_coroutine();
         return mParentHandle;
     }
 
 private:
     std::coroutine_handle<Promise<T>>  mWaitedHandle;
     std::coroutine_handle<PromiseBase> mParentHandle;
+    bool                               mStarting = false;
 };
 
 } // namespace tokoro::internal
\ No newline at end of file
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "defines.h"
+
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace tokoro::internal
+{
+
+// Generational slot map. Ids are the slot generation above the slot index, IndexBits and
+// GenerationBits wide. Find() is one indexed load plus a generation check, ids of erased values are
+// detected as stale. Freed slots are reused through a free list, and their generation is bumped.
+// Generations never wrap around: a slot whose generation is used up is retired instead of reused,
+// so a stale id never matches. Growing past 2^IndexBits slots throws std::length_error.
+//
+// Generations start at firstGeneration, and LastGeneration() is the highest one used so far, so
+// a later map can continue where this one stopped and never hand out the ids of this one.
+//
+// Slots are stored in chunks of 2^chunkBits slots which are never moved, so a value keeps its
+// address for its whole life. CoroManager needs that: the start function stored inline in an Entry
+// may hold the captures of a running coroutine. Chunks come from the memory resource given at
+// construction. The chunk size is chosen at construction too, a map of a known small size takes
+// one chunk of about its size, see ChunkBitsFor().
+template <typename T, uint32_t DefaultChunkBits = 8, uint32_t IndexBits = 32, uint32_t GenerationBits = 32>
+class SlotMap
+{
+public:
+    using Id = uint64_t; // 0 is never a valid id.
+
+    static_assert(IndexBits <= 32 && GenerationBits <= 32 && IndexBits + GenerationBits <= 64);
+    static_assert(DefaultChunkBits < IndexBits);
+
+    static constexpr uint64_t MaxGeneration = (uint64_t{1} << GenerationBits) - 1;
+
+    explicit SlotMap(std::pmr::memory_resource* resource        = std::pmr::get_default_resource(),
+                     uint64_t                   firstGeneration = 1,
+                     uint32_t                   chunkBits       = DefaultChunkBits)
+        : mChunks(resource),
+          mChunkBits(chunkBits),
+          mChunkSize(1u << chunkBits),
+          mFirstGeneration(static_cast<uint32_t>(firstGeneration)),
+          mLastGeneration(mFirstGeneration - 1)
+    {
+        assert(firstGeneration >= 1 && firstGeneration <= MaxGeneration);
+        assert(chunkBits < IndexBits);
+    }
+
+    SlotMap(const SlotMap&)            = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+    ~SlotMap()
+    {
+        Clear();
+
+        std::pmr::polymorphic_allocator<Slot> allocator = mChunks.get_allocator();
+        for (Slot* chunk : mChunks)
+        {
+            std::destroy_n(chunk, mChunkSize);
+            allocator.deallocate(chunk, mChunkSize);
+        }
+    }
+
+    // Default construct a new value.
+    std::pair<Id, T&> Emplace()
+    {
+        if (mFreeHead == NoSlot)
+            Grow();
+
+        const uint32_t index = mFreeHead;
+        Slot&          slot  = At(index);
+        mFreeHead            = slot.nextFree;
+
+        slot.value.emplace();
+        ++mSize;
+        return {MakeId(slot.generation, index), *slot.value};
+    }
+
+    // Null if the id is stale.
+    T* Find(Id id) noexcept
+    {
+        const uint32_t index = static_cast<uint32_t>(id & IndexMask);
+        if (index >= mCapacity)
+            return nullptr;
+
+        Slot& slot = At(index);
+        if (slot.generation != (id >> IndexBits) || !slot.value)
+            return nullptr;
+        return &*slot.value;
+    }
+
+    void Erase(Id id)
+    {
+        assert(Find(id) != nullptr);
+        Free(static_cast<uint32_t>(id & IndexMask));
+    }
+
+    // Destroy all values, slot by slot. Values may erase others from their destructors.
+    void Clear()
+    {
+        for (uint32_t index = 0; index < mCapacity; ++index)
+        {
+            if (At(index).value)
+                Free(index);
+        }
+    }
+
+    // The smallest chunk size holding count values in one chunk.
+    static constexpr uint32_t ChunkBitsFor(size_t count) noexcept
+    {
+        return count <= 1 ? 0 : static_cast<uint32_t>(std::bit_width(count - 1));
+    }
+
+    // Bytes a monotonic buffer needs to Reserve(count) from empty: the chunks and the chunk table.
+    static constexpr size_t StorageBytes(size_t count, uint32_t chunkBits = DefaultChunkBits) noexcept
+    {
+        const size_t chunkSize = size_t{1} << chunkBits;
+        const size_t chunks    = (count + chunkSize - 1) >> chunkBits;
+        return chunks * (chunkSize * sizeof(Slot) + alignof(Slot)) + chunks * sizeof(Slot*) + alignof(Slot*);
+    }
+
+    // Make room for count values, so emplacing up to count values doesn't allocate.
+    void Reserve(size_t count)
+    {
+        mChunks.reserve((count + mChunkSize - 1) >> mChunkBits);
+        while (mCapacity < count)
+            Grow();
+    }
+
+    size_t Size() const noexcept
+    {
+        return mSize;
+    }
+
+    uint64_t LastGeneration() const noexcept
+    {
+        return mLastGeneration;
+    }
+
+private:
+    static constexpr uint32_t NoSlot    = UINT32_MAX;
+
+    static constexpr uint64_t IndexMask      = (uint64_t{1} << IndexBits) - 1;
+
+    struct Slot
+    {
+        std::optional<T> value;
+        uint32_t         generation = 0;
+        uint32_t         nextFree   = NoSlot;
+    };
+
+    static Id MakeId(uint32_t generation, uint32_t index) noexcept
+    {
+        return (static_cast<Id>(generation) << IndexBits) | index;
+    }
+
+    Slot& At(uint32_t index) noexcept
+    {
+        return mChunks[index >> mChunkBits][index & (mChunkSize - 1)];
+    }
+
+    void Grow()
+    {
+        // The last chunk ends before IndexMask, which keeps NoSlot out of the indices.
+        if (mCapacity + uint64_t{mChunkSize} > IndexMask)
+            throw std::length_error("SlotMap is full.");
+
+        mChunks.push_back(nullptr);
+
+        std::pmr::polymorphic_allocator<Slot> allocator = mChunks.get_allocator();
+        try
+        {
+            mChunks.back() = allocator.allocate(mChunkSize);
+        }
+        catch (...)
+        {
+            mChunks.pop_back();
+            throw;
+        }
+        std::uninitialized_default_construct_n(mChunks.back(), mChunkSize);
+
+        // Chain the new slots in index order, so they're used in order.
+        const uint32_t first = mCapacity;
+        mCapacity += mChunkSize;
+        for (uint32_t index = first; index < mCapacity; ++index)
+        {
+            At(index).generation = mFirstGeneration;
+            At(index).nextFree   = index + 1 < mCapacity ? index + 1 : mFreeHead;
+        }
+        mFreeHead = first;
+        if (mLastGeneration < mFirstGeneration)
+            mLastGeneration = mFirstGeneration;
+    }
+
+    void Free(uint32_t index)
+    {
+        Slot& slot = At(index);
+
+        // Stale before destroying, so the value's destructor can't find itself. A slot which has
+        // used up its generations keeps an empty value and a used generation, which nothing finds.
+        const bool retire = slot.generation == MaxGeneration;
+        if (!retire)
+        {
+            ++slot.generation;
+            if (slot.generation > mLastGeneration)
+                mLastGeneration = slot.generation;
+        }
+        else
+        {
+            slot.generation = 0;
+        }
+        slot.value.reset();
+        --mSize;
+
+        if (!retire)
+        {
+            slot.nextFree = mFreeHead;
+            mFreeHead     = index;
+        }
+    }
+
+    std::pmr::vector<Slot*> mChunks;
+    uint32_t                mChunkBits;
+    uint32_t                mChunkSize;
+    uint32_t                mCapacity = 0;
+    uint32_t                mFreeHead = NoSlot;
+    size_t                  mSize     = 0;
+    uint32_t                mFirstGeneration;
+    uint32_t                mLastGeneration;
+};
+
+} // namespace tokoro::internal
@@ -3,21 +3,41 @@
 #include "defines.h"
 
 #include <cassert>
+#include <memory_resource>
+#include <optional>
 #include <set>
 
 namespace tokoro::internal
 {
 
-template <typename T>
-class TimeQueue
+// The original std::multiset based time queue. Every insertion allocates a tree node.
+// Kept selectable for A/B benchmarking against IntrusiveTimeQueue.
+//
+// All time queues share the same interface:
+//   Hook                      - Embedded in the queued object, carries the per-element state.
+//   AddTimed(hook, time, e)   - Queue e to be popped by the first update which time >= 'time'.
+//   Remove(hook)              - Remove a queued element.
+//   Pop()                     - Take the next element of current update. CheckUpdate() first.
+//   CheckUpdate()             - Whether current update still has elements to pop.
+//   SetupUpdate(exeTime)      - Start a new update. Elements added during an update never run in it.
+//   Clear()                   - Reset the queue. All hooks should be removed before.
+// Optionally:
+//   Queue(memory_resource*)   - Construct with the resource of the scheduler, for queues which allocate.
+//   Reserve(count)            - Make room for count elements, see SchedulerBP::Reserve.
+// TimeT is the time representation, double seconds or integer ticks. See TimeTraits.
+template <typename T, typename TimeT = double>
+class MultisetTimeQueue
 {
+public:
+    class Hook;
+
 private:
     struct Node
     {
-        double   time;
+        TimeT    time;
         uint32_t seq;
         uint32_t frame;
-        T        value;
+        Hook*    hook;
     };
 
     struct Comp
@@ -31,12 +51,27 @@ private:
         }
     };
 
-    using SetType = std::multiset<Node, Comp>;
+    using SetType  = std::pmr::multiset<Node, Comp>;
+    using Iterator = typename SetType::const_iterator;
 
 public:
-    using Iterator = typename SetType::const_iterator;
+    class Hook
+    {
+    public:
+        bool IsLinked() const noexcept
+        {
+            return mIter.has_value();
+        }
+
+    private:
+        friend class MultisetTimeQueue;
 
-    TimeQueue()
+        std::optional<Iterator> mIter;
+        T                       mValue{};
+    };
+
+    explicit MultisetTimeQueue(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : mSet(resource)
     {
         mUpdatePtr = mSet.end();
     }
@@ -50,13 +85,19 @@ public:
         mCurExeTime = 0;
     }
 
-    Iterator AddTimed(const double time, const T& e)
+    void AddTimed(Hook& hook, const TimeT time, const T& e)
     {
-        return AddImpl(time, e);
+        assert(!hook.IsLinked());
+
+        hook.mValue = e;
+        hook.mIter  = mSet.insert(Node{time, mAddOrder++, mAddFrame, &hook});
     }
 
-    void Remove(Iterator iter)
+    void Remove(Hook& hook)
     {
+        assert(hook.IsLinked());
+
+        const Iterator iter = *hook.mIter;
         if (iter == mUpdatePtr)
         {
             mUpdatePtr = mSet.erase(mUpdatePtr);
@@ -65,6 +106,7 @@ public:
         {
             mSet.erase(iter);
         }
+        hook.mIter.reset();
     }
 
     T Pop()
@@ -72,11 +114,12 @@ public:
         // User should CheckUpdate() before Pop()
         assert(mUpdatePtr != mSet.end());
 
-        T ret = std::move(mUpdatePtr->value);
+        Hook* hook = mUpdatePtr->hook;
 
         mUpdatePtr = mSet.erase(mUpdatePtr);
+        hook->mIter.reset();
 
-        return ret;
+        return hook->mValue;
     }
 
     bool CheckUpdate() noexcept
@@ -85,7 +128,7 @@ public:
         return !mSet.empty() && mSet.end() != mUpdatePtr;
     }
 
-    void SetupUpdate(double exeTime)
+    void SetupUpdate(TimeT exeTime)
     {
         mAddFrame++;
         mAddOrder   = 0;
@@ -119,17 +162,11 @@ private:
         }
     }
 
-    Iterator AddImpl(double time, const T& e)
-    {
-        Node node{time, mAddOrder++, mAddFrame, e};
-        return mSet.insert(std::move(node));
-    }
-
     SetType  mSet;
     uint32_t mAddOrder = 0;
     uint32_t mAddFrame = 0;
     Iterator mUpdatePtr;
-    double   mCurExeTime;
+    TimeT    mCurExeTime;
 };
 
-} // namespace tokoro::internal
\ No newline at end of file
+} // namespace tokoro::internal
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "defines.h"
+#include "intrusivelist.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <limits>
+#include <type_traits>
+
+namespace tokoro::internal
+{
+
+// Hierarchical timing wheel time queue. Times are converted to integer ticks (TicksPerSecond),
+// a wait is put into the slot of its tick on the lowest level which range can hold it.
+// AddTimed and Remove are O(1). SetupUpdate() walks the occupied slots up to the update time,
+// cascading higher levels down, which is amortized O(1) per wait.
+//
+// Waits due in the same update are popped tick by tick, and in add order within a tick.
+// So the order among waits inside one tick is less strict than MultisetTimeQueue.
+// Waits added during an update are never popped in the same update.
+//
+// Integer TimeT is already in ticks, one time unit per tick, and TicksPerSecond is unused.
+template <typename T, typename TimeT = double, uint32_t TicksPerSecond = 1000>
+class TimingWheelTimeQueue
+{
+private:
+    static constexpr uint32_t SlotBits   = 8;
+    static constexpr uint32_t SlotCount  = 1u << SlotBits;
+    static constexpr uint32_t SlotMask   = SlotCount - 1;
+    static constexpr uint32_t LevelCount = 4; // 2^32 ticks, around 49 days in milliseconds.
+    static constexpr uint32_t WordCount  = SlotCount / 64;
+
+    // Slot ids besides the wheel slots
+    static constexpr uint16_t NoSlot       = 0xFFFF;
+    static constexpr uint16_t ReadySlot    = LevelCount * SlotCount;
+    static constexpr uint16_t DeferredSlot = ReadySlot + 1;
+    static constexpr uint16_t OverflowSlot = ReadySlot + 2;
+
+public:
+    class Hook : public ListHook
+    {
+    public:
+        bool IsLinked() const noexcept
+        {
+            return mSlot != NoSlot;
+        }
+
+    private:
+        friend class TimingWheelTimeQueue;
+
+        TimeT    mTime = 0;
+        uint64_t mTick = 0;
+        T        mValue{};
+        uint16_t mSlot = NoSlot;
+    };
+
+    void Clear()
+    {
+        for (auto& slot : mSlots)
+            slot.Clear();
+        for (auto& words : mOccupied)
+            words.fill(0);
+        mReady.Clear();
+        mDeferred.Clear();
+        mOverflow.Clear();
+        mCurTick    = 0;
+        mCurExeTime = std::numeric_limits<TimeT>::lowest();
+    }
+
+    void AddTimed(Hook& hook, const TimeT time, const T& e)
+    {
+        assert(!hook.IsLinked());
+
+        hook.mTime  = time;
+        hook.mTick  = ToTick(time);
+        hook.mValue = e;
+
+        if (time <= mCurExeTime)
+            LinkTo(hook, DeferredSlot);
+        else
+            Place(hook);
+    }
+
+    void Remove(Hook& hook)
+    {
+        assert(hook.IsLinked());
+
+        const uint16_t slot = hook.mSlot;
+        ListOf(slot).Erase(&hook);
+        hook.mSlot = NoSlot;
+
+        if (slot < ReadySlot && mSlots[slot].Empty())
+            ClearOccupied(slot);
+    }
+
+    T Pop()
+    {
+        // User should CheckUpdate() before Pop()
+        assert(!mReady.Empty());
+
+        Hook* hook  = static_cast<Hook*>(mReady.PopFront());
+        hook->mSlot = NoSlot;
+        return hook->mValue;
+    }
+
+    bool CheckUpdate() const noexcept
+    {
+        return !mReady.Empty();
+    }
+
+    void SetupUpdate(TimeT exeTime)
+    {
+        mCurExeTime = exeTime;
+
+        // Waits deferred from last update are due before anything in the wheel.
+        MoveAll(mDeferred, ReadySlot);
+
+        const uint64_t targetTick = ToTick(exeTime);
+        while (mCurTick < targetTick)
+        {
+            // Everything in slots before the target tick is due.
+            CollectSlot(mCurTick & SlotMask, std::numeric_limits<TimeT>::max());
+            mCurTick = NextStop(targetTick);
+            Cascade();
+        }
+
+        if (mCurTick == targetTick)
+            CollectSlot(mCurTick & SlotMask, exeTime);
+    }
+
+private:
+    static uint64_t ToTick(TimeT time) noexcept
+    {
+        constexpr uint64_t maxTick = 1ull << 62;
+
+        if constexpr (std::is_integral_v<TimeT>)
+        {
+            if (time <= 0)
+                return 0;
+            return static_cast<uint64_t>(time) < maxTick ? static_cast<uint64_t>(time) : maxTick;
+        }
+        else
+        {
+            const double tick = static_cast<double>(time) * TicksPerSecond;
+            if (!(tick > 0))
+                return 0;
+            if (tick >= static_cast<double>(maxTick))
+                return maxTick;
+            return static_cast<uint64_t>(tick);
+        }
+    }
+
+    IntrusiveList& ListOf(uint16_t slot) noexcept
+    {
+        if (slot < ReadySlot)
+            return mSlots[slot];
+        else if (slot == ReadySlot)
+            return mReady;
+        else if (slot == DeferredSlot)
+            return mDeferred;
+        else
+            return mOverflow;
+    }
+
+    void LinkTo(Hook& hook, uint16_t slot) noexcept
+    {
+        hook.mSlot = slot;
+        ListOf(slot).PushBack(&hook);
+        if (slot < ReadySlot)
+            mOccupied[slot / SlotCount][(slot & SlotMask) / 64] |= 1ull << (slot & 63);
+    }
+
+    void ClearOccupied(uint16_t slot) noexcept
+    {
+        mOccupied[slot / SlotCount][(slot & SlotMask) / 64] &= ~(1ull << (slot & 63));
+    }
+
+    // Put a wait into the wheel, at the lowest level which can hold its tick.
+    void Place(Hook& hook) noexcept
+    {
+        const uint64_t tick  = hook.mTick < mCurTick ? mCurTick : hook.mTick;
+        const uint64_t delta = tick - mCurTick;
+
+        for (uint32_t level = 0; level < LevelCount; ++level)
+        {
+            const uint32_t shift = SlotBits * level;
+            if (delta < (1ull << (shift + SlotBits)))
+            {
+                LinkTo(hook, static_cast<uint16_t>(level * SlotCount + ((tick >> shift) & SlotMask)));
+                return;
+            }
+        }
+
+        LinkTo(hook, OverflowSlot);
+    }
+
+    void MoveAll(IntrusiveList& list, uint16_t slot) noexcept
+    {
+        while (!list.Empty())
+        {
+            Hook* hook = static_cast<Hook*>(list.PopFront());
+            LinkTo(*hook, slot);
+        }
+    }
+
+    // Move due waits of a level 0 slot to the ready list.
+    void CollectSlot(uint32_t index, TimeT exeTime) noexcept
+    {
+        IntrusiveList& slot = mSlots[index];
+
+        ListHook* node = slot.Front();
+        while (node != nullptr)
+        {
+            Hook* hook = static_cast<Hook*>(node);
+            node       = node->mListNext;
+
+            if (hook->mTime <= exeTime)
+            {
+                slot.Erase(hook);
+                LinkTo(*hook, ReadySlot);
+            }
+        }
+
+        if (slot.Empty())
+            ClearOccupied(static_cast<uint16_t>(index));
+    }
+
+    // On rotation boundaries of lower levels, re-place the waits of higher level slots.
+    void Cascade() noexcept
+    {
+        for (uint32_t level = 1; level <= LevelCount; ++level)
+        {
+            const uint32_t shift = SlotBits * level;
+            if ((mCurTick & ((1ull << shift) - 1)) != 0)
+                return;
+
+            IntrusiveList list;
+            if (level < LevelCount)
+            {
+                const uint16_t slot = static_cast<uint16_t>(level * SlotCount + ((mCurTick >> shift) & SlotMask));
+                list.SpliceBack(mSlots[slot]);
+                ClearOccupied(slot);
+            }
+            else
+            {
+                list.SpliceBack(mOverflow);
+            }
+
+            while (!list.Empty())
+                Place(*static_cast<Hook*>(list.PopFront()));
+        }
+    }
+
+    // Find the next tick after mCurTick which has level 0 waits or needs a cascade, capped by targetTick.
+    uint64_t NextStop(uint64_t targetTick) const noexcept
+    {
+        for (uint32_t level = 0; level < LevelCount; ++level)
+        {
+            const uint32_t shift         = SlotBits * level;
+            const uint64_t rotationSize  = 1ull << (shift + SlotBits);
+            const uint64_t rotationStart = mCurTick & ~(rotationSize - 1);
+
+            const uint32_t next = FindOccupied(level, static_cast<uint32_t>((mCurTick >> shift) & SlotMask) + 1);
+            if (next < SlotCount)
+                return std::min(targetTick, rotationStart + (static_cast<uint64_t>(next) << shift));
+
+            // Waits left in this level belong to its next rotation.
+            if (FindOccupied(level, 0) < SlotCount)
+                return std::min(targetTick, rotationStart + rotationSize);
+        }
+
+        if (!mOverflow.Empty())
+        {
+            constexpr uint64_t wheelSize = 1ull << (SlotBits * LevelCount);
+            return std::min(targetTick, (mCurTick & ~(wheelSize - 1)) + wheelSize);
+        }
+
+        return targetTick;
+    }
+
+    // First occupied slot index >= begin of the level. SlotCount if none.
+    uint32_t FindOccupied(uint32_t level, uint32_t begin) const noexcept
+    {
+        for (uint32_t word = begin / 64; word < WordCount; ++word)
+        {
+            uint64_t bits = mOccupied[level][word];
+            if (word == begin / 64)
+                bits &= ~0ull << (begin & 63);
+            if (bits != 0)
+                return word * 64 + static_cast<uint32_t>(std::countr_zero(bits));
+        }
+        return SlotCount;
+    }
+
+    std::array<IntrusiveList, LevelCount * SlotCount>             mSlots;
+    std::array<std::array<uint64_t, WordCount>, LevelCount>       mOccupied{};
+    IntrusiveList                                                 mReady;
+    IntrusiveList                                                 mDeferred;
+    IntrusiveList                                                 mOverflow;
+    uint64_t                                                      mCurTick    = 0;
+    TimeT                                                         mCurExeTime = std::numeric_limits<TimeT>::lowest();
+};
+
+} // namespace tokoro::internal
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "defines.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TOKORO_TSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TOKORO_TSC 1
+#endif
+
+namespace tokoro::internal
+{
+
+// Seconds since first use, read from the time stamp counter. rdtsc is a few cycles, while
+// steady_clock::now() goes through the vDSO and converts on every read.
+// At first use the TSC frequency is calibrated against steady_clock by short busy waits. Samples
+// preempted between their TSC reads are retaken, and two consecutive windows must agree on the
+// rate, so a preemption or a frequency change during calibration doesn't skew it.
+// Where the TSC is not invariant (it may change speed or stop with power states), the windows never
+// agree, or the CPU is not x86, it falls back to steady_clock.
+class TscClock
+{
+public:
+    // Whether Now() reads the TSC.
+    static bool IsTscUsed() noexcept
+    {
+        return GetCalibration().useTsc;
+    }
+
+    // Fenced waits for prior instructions to finish before reading (rdtscp), for measuring.
+    template <bool Fenced = false>
+    static double Now() noexcept
+    {
+        const Calibration& calibration = GetCalibration();
+#if defined(TOKORO_TSC)
+        if (calibration.useTsc)
+        {
+            // Another core's TSC may be slightly behind the one read at calibration.
+            const uint64_t tsc = ReadTsc<Fenced>();
+            return tsc > calibration.startTsc ? static_cast<double>(tsc - calibration.startTsc) * calibration.secondsPerTick : 0.0;
+        }
+#endif
+        const std::chrono::duration<double> diff = std::chrono::steady_clock::now() - calibration.startTime;
+        return diff.count();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds CalibrationTime{10};
+
+    // Windows measured before giving up on the TSC, and how much two consecutive ones may differ.
+    static constexpr int    CalibrationAttempts = 5;
+    static constexpr double RateTolerance       = 0.001;
+
+    // A sample whose TSC reads are further apart was likely preempted, it's retaken. The reads are
+    // around one steady_clock::now(), tens of nanoseconds, so this is some microseconds.
+    static constexpr uint64_t MaxSampleTicks = 20000;
+    static constexpr int      SampleAttempts = 16;
+
+    struct Calibration
+    {
+        bool              useTsc         = false;
+        uint64_t          startTsc       = 0;
+        double            secondsPerTick = 0;
+        Clock::time_point startTime;
+    };
+
+    static const Calibration& GetCalibration() noexcept
+    {
+        static const Calibration calibration = Calibrate();
+        return calibration;
+    }
+
+    static Calibration Calibrate() noexcept
+    {
+        Calibration calibration;
+        calibration.startTime = Clock::now();
+
+#if defined(TOKORO_TSC)
+        if (!HasInvariantTsc())
+            return calibration;
+
+        // The first reads may fault in the vDSO page, don't calibrate with them.
+        Sample(calibration.startTime);
+        calibration.startTsc = Sample(calibration.startTime);
+
+        // Back to back windows, the end of one starts the next.
+        Clock::time_point windowStart    = calibration.startTime;
+        uint64_t          windowStartTsc = calibration.startTsc;
+        double            lastRate       = 0;
+        for (int attempt = 0; attempt < CalibrationAttempts; ++attempt)
+        {
+            Clock::time_point windowEnd;
+            uint64_t          windowEndTsc;
+            do
+            {
+                windowEndTsc = Sample(windowEnd);
+            } while (windowEnd - windowStart < CalibrationTime);
+
+            if (windowEndTsc <= windowStartTsc)
+                return calibration;
+
+            const std::chrono::duration<double> elapsed = windowEnd - windowStart;
+            const double rate = elapsed.count() / static_cast<double>(windowEndTsc - windowStartTsc);
+            if (lastRate != 0 && std::abs(rate - lastRate) <= RateTolerance * lastRate)
+            {
+                // Over the whole calibration, it's the most precise.
+                const std::chrono::duration<double> total = windowEnd - calibration.startTime;
+                calibration.secondsPerTick = total.count() / static_cast<double>(windowEndTsc - calibration.startTsc);
+                calibration.useTsc         = true;
+                return calibration;
+            }
+
+            lastRate       = rate;
+            windowStart    = windowEnd;
+            windowStartTsc = windowEndTsc;
+        }
+#endif
+        return calibration;
+    }
+
+#if defined(TOKORO_TSC)
+    // CPUID.80000007H:EDX[8]
+    static bool HasInvariantTsc() noexcept
+    {
+#if defined(_MSC_VER)
+        int regs[4] = {};
+        __cpuid(regs, 0x80000000);
+        if (static_cast<unsigned>(regs[0]) < 0x80000007u)
+            return false;
+        __cpuid(regs, 0x80000007);
+        return (regs[3] & (1 << 8)) != 0;
+#else
+        unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (__get_cpuid_max(0x80000000u, nullptr) < 0x80000007u)
+            return false;
+        __get_cpuid(0x80000007u, &eax, &ebx, &ecx, &edx);
+        return (edx & (1u << 8)) != 0;
+#endif
+    }
+
+    // Read steady_clock, and the TSC at the middle of that read. Of the attempts, the one with the
+    // TSC reads closest together is kept.
+    static uint64_t Sample(Clock::time_point& time) noexcept
+    {
+        uint64_t bestGap = UINT64_MAX;
+        uint64_t bestTsc = 0;
+        for (int attempt = 0; attempt < SampleAttempts && bestGap > MaxSampleTicks; ++attempt)
+        {
+            const uint64_t          before = ReadTsc<true>();
+            const Clock::time_point now    = Clock::now();
+            const uint64_t          after  = ReadTsc<true>();
+            if (after >= before && after - before < bestGap)
+            {
+                bestGap = after - before;
+                bestTsc = before + (after - before) / 2;
+                time    = now;
+            }
+        }
+        return bestTsc;
+    }
+
+    template <bool Fenced>
+    static uint64_t ReadTsc() noexcept
+    {
+        if constexpr (Fenced)
+        {
+            unsigned aux;
+            return __rdtscp(&aux);
+        }
+        else
+        {
+            return __rdtsc();
+        }
+    }
+#endif
+};
+
+} // namespace tokoro::internal
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "defines.h"
+#include "intrusivelist.h"
+
+#include <cassert>
+#include <cstdint>
+#include <memory_resource>
+#include <type_traits>
+
+namespace tokoro::internal
+{
+
+// Queue of one (UpdateEnum, TimeEnum) pair in the scheduler.
+// Waits for the next update (no delay) are FIFO by nature, they go into two intrusive lists
+// which swap in SetupUpdate(): O(1) for add, remove and pop, nothing to sort or skip.
+// Delayed waits go to the TimedQueue.
+//
+// Frame waits are keyed on the update counter of this queue, in a ring of lists indexed by the
+// target update. Waits further than the ring go to a far list, which is redistributed into the
+// ring once per round. So a frame wait costs one O(1) insertion and one resume, whatever its count.
+//
+// Resume order in an update: all next update waits in add order, then the due frame waits in add
+// order, then the due timed waits.
+//
+// T is a pointer to the queued type, which derives from Hook (and befriends the queue if privately).
+// Hooks only hold links, the element is the hook's owner, so queuing copies no value.
+template <typename T, template <typename, typename> class TimedQueue, typename TimeT>
+class UpdateQueue
+{
+private:
+    static constexpr uint8_t  TimedList     = 2;
+    static constexpr uint8_t  FrameList     = 3; // In mFrameSlots[mTargetFrame & FrameSlotMask]
+    static constexpr uint8_t  FarFrameList  = 4;
+    static constexpr uint8_t  NoList        = 5;
+    static constexpr uint32_t FrameSlotBits = 4; // Small, it is in the scheduler object once per queue.
+    static constexpr uint32_t FrameSlots    = 1u << FrameSlotBits;
+    static constexpr uint32_t FrameSlotMask = FrameSlots - 1;
+
+public:
+    class Hook : public ListHook
+    {
+    public:
+        bool IsLinked() const noexcept
+        {
+            // Popping from the timed queue only unlinks mTimedHook.
+            return mList != NoList && (mList != TimedList || mTimedHook.IsLinked());
+        }
+
+    private:
+        friend class UpdateQueue;
+
+        typename TimedQueue<T, TimeT>::Hook mTimedHook;
+        uint32_t                            mTargetFrame = 0;
+        uint8_t                             mList        = NoList;
+    };
+
+    void Clear()
+    {
+        mLists[0].Clear();
+        mLists[1].Clear();
+        for (IntrusiveList& slot : mFrameSlots)
+            slot.Clear();
+        mFarFrames.Clear();
+        mTimed.Clear();
+        mCurList = 0;
+        mFrame   = 0;
+    }
+
+    explicit UpdateQueue(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : mTimed(MakeTimed(resource))
+    {
+    }
+
+    // Pre-size the timed queue for count pending waits, if it has storage to size.
+    void Reserve(size_t count)
+    {
+        if constexpr (requires { mTimed.Reserve(count); })
+            mTimed.Reserve(count);
+    }
+
+    void AddNext(Hook& hook)
+    {
+        assert(!hook.IsLinked());
+
+        hook.mList = NextList();
+        mLists[hook.mList].PushBack(&hook);
+    }
+
+    // Queue the hook's owner to be popped by the frames-th update from now. frames > 0.
+    void AddFrames(Hook& hook, const uint32_t frames)
+    {
+        assert(!hook.IsLinked() && frames > 0);
+
+        if (frames == 1)
+        {
+            AddNext(hook);
+            return;
+        }
+
+        hook.mTargetFrame = mFrame + frames;
+        if (frames < FrameSlots)
+        {
+            hook.mList = FrameList;
+            mFrameSlots[hook.mTargetFrame & FrameSlotMask].PushBack(&hook);
+        }
+        else
+        {
+            hook.mList = FarFrameList;
+            mFarFrames.PushBack(&hook);
+        }
+    }
+
+    void AddTimed(Hook& hook, const TimeT time)
+    {
+        assert(!hook.IsLinked());
+
+        hook.mList = TimedList;
+        mTimed.AddTimed(hook.mTimedHook, time, OwnerOf(&hook));
+    }
+
+    void Remove(Hook& hook)
+    {
+        assert(hook.IsLinked());
+
+        if (hook.mList == TimedList)
+            mTimed.Remove(hook.mTimedHook);
+        else if (hook.mList == FrameList)
+            mFrameSlots[hook.mTargetFrame & FrameSlotMask].Erase(&hook);
+        else if (hook.mList == FarFrameList)
+            mFarFrames.Erase(&hook);
+        else
+            mLists[hook.mList].Erase(&hook);
+
+        hook.mList = NoList;
+    }
+
+    T Pop()
+    {
+        // User should CheckUpdate() before Pop()
+        IntrusiveList& current = mLists[mCurList];
+        if (!current.Empty())
+            return PopFront(current);
+
+        IntrusiveList& dueFrames = mFrameSlots[mFrame & FrameSlotMask];
+        if (!dueFrames.Empty())
+            return PopFront(dueFrames);
+
+        return mTimed.Pop();
+    }
+
+    bool CheckUpdate() noexcept
+    {
+        return !mLists[mCurList].Empty() || !mFrameSlots[mFrame & FrameSlotMask].Empty() || mTimed.CheckUpdate();
+    }
+
+    void SetupUpdate(TimeT exeTime)
+    {
+        IntrusiveList& current = mLists[mCurList];
+        IntrusiveList& next    = mLists[NextList()];
+        if (current.Empty())
+        {
+            mCurList = NextList();
+        }
+        else
+        {
+            // Last update was interrupted, keep its leftovers in front.
+            while (!next.Empty())
+            {
+                Hook* hook  = static_cast<Hook*>(next.PopFront());
+                hook->mList = mCurList;
+                current.PushBack(hook);
+            }
+        }
+
+        SetupFrames();
+        mTimed.SetupUpdate(exeTime);
+    }
+
+private:
+    static TimedQueue<T, TimeT> MakeTimed(std::pmr::memory_resource* resource)
+    {
+        if constexpr (std::is_constructible_v<TimedQueue<T, TimeT>, std::pmr::memory_resource*>)
+            return TimedQueue<T, TimeT>(resource);
+        else
+            return TimedQueue<T, TimeT>();
+    }
+
+    static T OwnerOf(Hook* hook) noexcept
+    {
+        return static_cast<T>(hook);
+    }
+
+    static T PopFront(IntrusiveList& list) noexcept
+    {
+        Hook* hook  = static_cast<Hook*>(list.PopFront());
+        hook->mList = NoList;
+        return OwnerOf(hook);
+    }
+
+    void SetupFrames() noexcept
+    {
+        IntrusiveList& lastSlot = mFrameSlots[mFrame & FrameSlotMask];
+        ++mFrame;
+        IntrusiveList& dueSlot = mFrameSlots[mFrame & FrameSlotMask];
+
+        if (!lastSlot.Empty())
+        {
+            // Last update was interrupted, its leftovers are due now and stay in front.
+            lastSlot.SpliceBack(dueSlot);
+            dueSlot.SpliceBack(lastSlot);
+            for (ListHook* node = dueSlot.Front(); node != nullptr; node = node->mListNext)
+                static_cast<Hook*>(node)->mTargetFrame = mFrame;
+        }
+
+        // New round of the ring, pull the far waits which fit in it now.
+        if ((mFrame & FrameSlotMask) == 0)
+        {
+            ListHook* node = mFarFrames.Front();
+            while (node != nullptr)
+            {
+                Hook* hook = static_cast<Hook*>(node);
+                node       = node->mListNext;
+                if (hook->mTargetFrame - mFrame < FrameSlots)
+                {
+                    mFarFrames.Erase(hook);
+                    hook->mList = FrameList;
+                    mFrameSlots[hook->mTargetFrame & FrameSlotMask].PushBack(hook);
+                }
+            }
+        }
+    }
+
+    uint8_t NextList() const noexcept
+    {
+        return mCurList ^ 1;
+    }
+
+    IntrusiveList        mLists[2];
+    uint8_t              mCurList = 0;
+    IntrusiveList        mFrameSlots[FrameSlots];
+    IntrusiveList        mFarFrames;
+    uint32_t             mFrame = 0; // Update counter, frame waits are keyed on it.
+    TimedQueue<T, TimeT> mTimed;
+};
+
+} // namespace tokoro::internal
@@ -1,10 +1,18 @@
 #pragma once
 
+#include "internal/daryheaptimequeue.h"
 #include "internal/defines.h"
+#include "internal/fixedblockresource.h"
+#include "internal/intrusivetimequeue.h"
 #include "internal/promise.h"
+#include "internal/schedulerregistry.h"
 #include "internal/singleawaiter.h"
+#include "internal/slotmap.h"
 #include "internal/timequeue.h"
+#include "internal/timingwheel.h"
 #include "internal/tmplany.h"
+#include "internal/tscclock.h"
+#include "internal/updatequeue.h"
 
 #include <any>
 #include <array>
@@ -12,20 +20,164 @@
 #include <chrono>
 #include <coroutine>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <new>
 #include <optional>
+#include <ranges>
+#include <tuple>
+#include <vector>
 
 namespace tokoro
 {
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
+// Time domain of a TimeEnum. Default is double seconds. Specialize it to use integer ticks,
+// which makes deadline comparisons exact and the queue keys cheaper:
+//   template <>
+//   struct tokoro::TimeTraits<MyTimeType>
+//   {
+//       using Duration = std::chrono::milliseconds;
+//   };
+// Custom timers of the scheduler then return Duration::rep, the current time in Duration units.
+template <typename TimeEnum>
+struct TimeTraits
+{
+    using Duration = std::chrono::duration<double>;
+};
+
+// Timer policies. A timer policy is a type with a Now(TimeEnum) member or static function, which
+// returns the current time of the time type in TimeTraits<TimeEnum>::Duration units.
+// The scheduler owns one instance and calls it directly, so a simple policy gets fully inlined.
+
+// Steady clock time since the first read, for all time types.
+template <internal::CountEnum TimeEnum>
+struct SteadyTimer
+{
+    using Duration = typename TimeTraits<TimeEnum>::Duration;
+
+    static typename Duration::rep Now(TimeEnum) noexcept
+    {
+        using Clock     = std::chrono::steady_clock;
+        using TimePoint = Clock::time_point;
+
+        static TimePoint startTime = Clock::now();
+        return std::chrono::duration_cast<Duration>(Clock::now() - startTime).count();
+    }
+};
+
+// Time stamp counter time since the first read, for all time types. Much cheaper to read than
+// steady_clock, see TscClock. Falls back to steady_clock where the TSC is not invariant.
+template <internal::CountEnum TimeEnum, bool Fenced = false>
+struct TscTimer
+{
+    using Duration = typename TimeTraits<TimeEnum>::Duration;
+
+    // The scheduler constructs it, so the calibration busy wait happens there, not in the first Update().
+    TscTimer() noexcept
+    {
+        internal::TscClock::IsTscUsed();
+    }
+
+    static typename Duration::rep Now(TimeEnum) noexcept
+    {
+        const std::chrono::duration<double> now(internal::TscClock::Now<Fenced>());
+        return std::chrono::duration_cast<Duration>(now).count();
+    }
+};
+
+// Default policy, a custom timer function per time type set at runtime by SetCustomTimer().
+// Time types without custom timer use SteadyTimer.
+template <internal::CountEnum TimeEnum>
+class DynamicTimer
+{
+public:
+    using TimeRep = typename TimeTraits<TimeEnum>::Duration::rep;
+
+    void SetCustomTimer(TimeEnum timeType, std::function<TimeRep()> getTimeFunc)
+    {
+        mCustomTimers[static_cast<int>(timeType)] = std::move(getTimeFunc);
+    }
+
+    TimeRep Now(TimeEnum timeType)
+    {
+        auto& customTimer = mCustomTimers[static_cast<int>(timeType)];
+        if (customTimer)
+        {
+            return customTimer();
+        }
+        else
+        {
+            return SteadyTimer<TimeEnum>::Now(timeType);
+        }
+    }
+
+private:
+    std::array<std::function<TimeRep()>, static_cast<int>(TimeEnum::Count)> mCustomTimers;
+};
+
+// How the scheduler reads the timer to compute the deadline of new delayed waits.
+enum class TimeSampling
+{
+    // Read once per Update() or outermost Start() and shared by all waits added inside.
+    // Waits started together in a frame get the same base time, like a game frame time.
+    Snapshot,
+    // Read for every delayed wait.
+    Precise,
+};
+
+// Compile time options of SchedulerBP. Derive from it and override what you need:
+//   struct MyConfig : tokoro::DefaultSchedulerConfig
+//   {
+//       template <typename T, typename TimeT>
+//       using TimeQueue = tokoro::internal::MultisetTimeQueue<T, TimeT>;
+//   };
+struct DefaultSchedulerConfig
+{
+    // Queue type of delayed waits in each update queue. See MultisetTimeQueue for the interface.
+    // TimeT is TimeTraits<TimeEnum>::Duration::rep. Waits without delay always go to a FIFO list instead.
+    template <typename T, typename TimeT>
+    using TimeQueue = internal::IntrusiveTimeQueue<T, TimeT>;
+
+    static constexpr TimeSampling Sampling = TimeSampling::Snapshot;
+
+    // Timer policy, see DynamicTimer. Use SchedulerBP::GetTimer() to reach a stateful policy.
+    template <typename TimeEnum>
+    using Timer = DynamicTimer<TimeEnum>;
+};
+
+// Config of a scheduler which never allocates after construction: the coroutine table and the frames
+// are stored in the scheduler object itself.
+//   MaxCoroutines - Root coroutines with an entry at once: running, or finished with a live handle.
+//   FrameCount    - Coroutine frames alive at once, nested ones and large results included.
+//   FrameSize     - Max size of a frame in bytes.
+// Start returns an invalid Handle when the table is full, no frame is left, or the root frame is
+// larger than FrameSize. A nested coroutine which finds no frame left, or a frame larger than
+// FrameSize, throws std::bad_alloc into its caller.
+// Waits are stored in the frames and linked into the queue intrusively, so they're bounded by
+// FrameCount. Time queues which allocate (MultisetTimeQueue, DaryHeapTimeQueue) are rejected.
+template <size_t MaxCoroutinesV, size_t FrameCountV, size_t FrameSizeV = 512>
+struct FixedCapacityConfig : DefaultSchedulerConfig
+{
+    static constexpr size_t MaxCoroutines = MaxCoroutinesV;
+    static constexpr size_t FrameCount    = FrameCountV;
+    static constexpr size_t FrameSize     = FrameSizeV;
+};
+
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config = DefaultSchedulerConfig>
 class SchedulerBP;
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-class WaitBP
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config = DefaultSchedulerConfig>
+class WaitFramesBP;
+
+// A wait is its own node in the update queue, see UpdateQueue.
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config = DefaultSchedulerConfig>
+class WaitBP : private internal::UpdateQueue<WaitBP<UpdateEnum, TimeEnum, Config>*, Config::template TimeQueue, typename TimeTraits<TimeEnum>::Duration::rep>::Hook
 {
 public:
     WaitBP(double sec, UpdateEnum updateType = internal::GetEnumDefault<UpdateEnum>(), TimeEnum timeType = internal::GetEnumDefault<TimeEnum>());
+    template <typename Rep, typename Period>
+    WaitBP(std::chrono::duration<Rep, Period> delay, UpdateEnum updateType = internal::GetEnumDefault<UpdateEnum>(), TimeEnum timeType = internal::GetEnumDefault<TimeEnum>());
     WaitBP(UpdateEnum updateType = internal::GetEnumDefault<UpdateEnum>(), TimeEnum timeType = internal::GetEnumDefault<TimeEnum>());
     ~WaitBP();
 
@@ -39,13 +191,35 @@ public:
     void Resume();
 
 private:
-    friend class SchedulerBP<UpdateEnum, TimeEnum>;
+    friend class SchedulerBP<UpdateEnum, TimeEnum, Config>;
+    friend class WaitFramesBP<UpdateEnum, TimeEnum, Config>;
+
+    using Duration  = typename TimeTraits<TimeEnum>::Duration;
+    using TimeRep   = typename Duration::rep;
+    using QueueType = internal::UpdateQueue<WaitBP*, Config::template TimeQueue, TimeRep>;
+    friend QueueType;
+
+    // Delays are rounded up to the time domain, so an integer domain never resumes too early.
+    template <typename Rep, typename Period>
+    static TimeRep ToDelay(std::chrono::duration<Rep, Period> delay);
+
+    TimeRep                                      mDelay;
+    uint32_t                                     mFrames = 0; // Frame wait if not 0, mDelay is unused then.
+    std::coroutine_handle<internal::PromiseBase> mHandle = nullptr;
+    UpdateEnum                                   mUpdateType;
+    TimeEnum                                     mTimeType;
+};
 
-    std::optional<typename internal::TimeQueue<WaitBP*>::Iterator> mExeIter;
-    double                                                         mDelay;
-    std::coroutine_handle<internal::PromiseBase>                   mHandle = nullptr;
-    UpdateEnum                                                     mUpdateType;
-    TimeEnum                                                       mTimeType;
+// Resume on the frames-th update of updateType from now. It's keyed on the update counter, the timer
+// is never read. Cheaper than awaiting Wait() frames times: one suspension and one resume.
+// WaitFrames(1) is the same as Wait(), WaitFrames(0) doesn't suspend.
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+class WaitFramesBP : public WaitBP<UpdateEnum, TimeEnum, Config>
+{
+public:
+    WaitFramesBP(uint32_t frames, UpdateEnum updateType = internal::GetEnumDefault<UpdateEnum>(), TimeEnum timeType = internal::GetEnumDefault<TimeEnum>());
+
+    bool await_ready() const noexcept;
 };
 
 namespace internal
@@ -61,6 +235,9 @@ enum class AsyncState
     Stopped, // When coroutine stopped by Handle.
 };
 
+template <typename SchedulerT>
+class CoroScope;
+
 template <typename T>
 class Handle
 {
@@ -110,18 +287,18 @@ public:
 
 private:
     friend class internal::CoroManager;
+    template <typename SchedulerT>
+    friend class CoroScope;
 
-    Handle(uint64_t id, internal::CoroManager* coroMgr, const std::weak_ptr<std::monostate>& liveSignal)
-        : mId(id), mCoroMgr(coroMgr), mCoroMgrLiveSignal(liveSignal)
+    explicit Handle(uint64_t id) noexcept
+        : mId(id)
     {
     }
 
     void Reset();
 
-    uint64_t                      mId            = 0;
-    bool                          mBoundLifetime = true;
-    internal::CoroManager*        mCoroMgr       = nullptr;
-    std::weak_ptr<std::monostate> mCoroMgrLiveSignal;
+    // The registry index of the scheduler above the slot id of the coroutine, see CoroManager::MakeHandleId().
+    uint64_t mId = 0;
 };
 
 template <typename... Ts>
@@ -130,20 +307,22 @@ class Any;
 template <typename... Ts>
 class All;
 
+// The typed handle is stored as is and a temporary Async awaited right away is scoped to the
+// co_await expression, so the optimizer can see through it.
 template <typename T>
-class Async
+class TOKORO_CORO_AWAIT_ELIDABLE Async
 {
 public:
     using promise_type = internal::Promise<T>;
     using value_type   = T;
     using handle_type  = std::coroutine_handle<promise_type>;
 
-    Async(handle_type h)
+    Async(handle_type h) noexcept
         : mHandle(h)
     {
     }
 
-    Async(Async&& o)
+    Async(Async&& o) noexcept
         : mHandle(o.mHandle)
     {
         o.mHandle = nullptr;
@@ -177,9 +356,9 @@ private:
         GetCppHandle().promise().SetCoroManager(coroMgr);
     }
 
-    std::coroutine_handle<promise_type> GetCppHandle()
+    handle_type GetCppHandle() const noexcept
     {
-        return std::coroutine_handle<promise_type>::from_address(mHandle.address());
+        return mHandle;
     }
 
     void Resume()
@@ -187,7 +366,7 @@ private:
         mHandle.resume();
     }
 
-    std::coroutine_handle<> mHandle;
+    handle_type mHandle;
 };
 
 namespace internal
@@ -205,12 +384,249 @@ template <typename Func, typename... Args>
 concept ReturnsAsync = std::invocable<Func, Args...> &&
                        std::same_as<AsyncReturnT<Func, Args...>, Async<AsyncValueT<Func, Args...>>>;
 
+// A batch start calls the same function with each element of a range.
+template <typename Func, typename Range>
+concept ReturnsAsyncForEach = std::ranges::input_range<Range> && ReturnsAsync<Func&, std::ranges::range_reference_t<Range>>;
+
+template <typename Func, typename Range>
+using BatchValueT = AsyncValueT<Func&, std::ranges::range_reference_t<Range>>;
+
+// Keeps the start function and its arguments alive as long as the coroutine, to avoid the famous C++
+// coroutine pitfall: a capturing lambda coroutine reads its captures from the lambda object, and
+// reference parameters bind to the stored arguments.
+// https://devblogs.microsoft.com/oldnewthing/20211103-00/?p=105870
+// <A capturing lambda can be a coroutine, but you have to save your captures while you still can>
+//
+// Small ones are stored inline. Larger ones are moved into the frame of a wrapper coroutine which
+// awaits the real one, so they share the frame allocation. Either way starting doesn't allocate
+// for them. With InBlock, larger ones go to a block allocated like a frame (see AllocateFrame())
+// instead, taken before the coroutine is created: a fixed capacity scheduler then sees every frame
+// it can't serve in Start itself, not at the first resume of the wrapper.
+class StartStorage
+{
+public:
+    static constexpr size_t InlineSize = 6 * sizeof(void*);
+
+    StartStorage() = default;
+
+    StartStorage(const StartStorage&)            = delete;
+    StartStorage& operator=(const StartStorage&) = delete;
+
+    ~StartStorage()
+    {
+        Reset();
+    }
+
+    // Store func and its arguments, then create the coroutine from them.
+    template <bool InBlock, typename AsyncFunc, typename... Args>
+    auto Start(AsyncFunc&& func, Args&&... funcArgs)
+    {
+        using Call = BoundCall<std::decay_t<AsyncFunc>, decltype(std::make_tuple(std::forward<Args>(funcArgs)...))>;
+        assert(mDestroy == nullptr);
+
+        if constexpr (sizeof(Call) <= InlineSize && alignof(Call) <= alignof(std::max_align_t))
+        {
+            Call* call = new (mStorage) Call{std::forward<AsyncFunc>(func), std::make_tuple(std::forward<Args>(funcArgs)...)};
+            mDestroy   = [](void* ptr) noexcept { static_cast<Call*>(ptr)->~Call(); };
+            return (*call)();
+        }
+        else if constexpr (!InBlock)
+        {
+            return InFrame(Call{std::forward<AsyncFunc>(func), std::make_tuple(std::forward<Args>(funcArgs)...)});
+        }
+        else
+        {
+            static_assert(alignof(Call) <= alignof(std::max_align_t), "Over-aligned start functions are not supported.");
+
+            void* block = AllocateFrame(sizeof(Call));
+            Call* call;
+            try
+            {
+                call = new (block) Call{std::forward<AsyncFunc>(func), std::make_tuple(std::forward<Args>(funcArgs)...)};
+            }
+            catch (...)
+            {
+                DeallocateFrame(block, sizeof(Call));
+                throw;
+            }
+
+            new (mStorage) Call*(call);
+            mDestroy = [](void* ptr) noexcept {
+                Call* call = *static_cast<Call**>(ptr);
+                call->~Call();
+                DeallocateFrame(call, sizeof(Call));
+            };
+            return (*call)();
+        }
+    }
+
+    void Reset() noexcept
+    {
+        if (mDestroy != nullptr)
+        {
+            mDestroy(mStorage);
+            mDestroy = nullptr;
+        }
+    }
+
+private:
+    template <typename Call>
+    static std::invoke_result_t<Call&> InFrame(Call call)
+    {
+        co_return co_await call();
+    }
+
+    template <typename Func, typename Tuple>
+    struct BoundCall
+    {
+        // GCC 12 warns about the virtual call branch of a member function pointer applied to an object
+        // smaller than a vtable pointer, once inlined, even though the branch is never taken.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#endif
+        auto operator()()
+        {
+            return std::apply(func, args);
+        }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+        Func  func;
+        Tuple args;
+    };
+
+    alignas(std::max_align_t) unsigned char mStorage[InlineSize];
+    void (*mDestroy)(void*) noexcept = nullptr;
+};
+
+// Result of a finished root coroutine, moved out of its promise so the frame can be freed at once.
+// Small results are stored inline, larger ones are allocated like a frame, see AllocateFrame().
+class ResultSlot
+{
+public:
+    static constexpr size_t InlineSize = 2 * sizeof(void*);
+
+    ResultSlot() = default;
+
+    ResultSlot(const ResultSlot&)            = delete;
+    ResultSlot& operator=(const ResultSlot&) = delete;
+
+    ~ResultSlot()
+    {
+        Reset();
+    }
+
+    template <typename T>
+    static constexpr bool IsInline = sizeof(T) <= InlineSize && alignof(T) <= alignof(std::max_align_t) &&
+                                     std::is_nothrow_move_constructible_v<T>;
+
+    // A large value goes to kept, the block of the finished frame, when given. It's owned by the
+    // slot from here on, even if this throws. Otherwise the block is allocated like a frame.
+    template <typename T>
+    void SetValue(T&& value, KeptFrame kept = {})
+    {
+        using U = std::decay_t<T>;
+        assert(mDestroy == nullptr);
+
+        if constexpr (IsInline<U>)
+        {
+            assert(kept.size == 0);
+            new (mStorage) U(std::forward<T>(value));
+            mDestroy = [](void* ptr) noexcept { static_cast<U*>(ptr)->~U(); };
+        }
+        else
+        {
+            static_assert(alignof(U) <= alignof(std::max_align_t), "Over-aligned results are not supported.");
+
+            if (kept.size < sizeof(U))
+            {
+                if (kept.size != 0)
+                    DeallocateFrame(kept.frame, kept.size);
+                kept = {AllocateFrame(sizeof(U)), sizeof(U)};
+            }
+
+            try
+            {
+                new (kept.frame) U(std::forward<T>(value));
+            }
+            catch (...)
+            {
+                DeallocateFrame(kept.frame, kept.size);
+                throw;
+            }
+
+            new (mStorage) KeptFrame(kept);
+            mDestroy = [](void* ptr) noexcept {
+                const KeptFrame block = *static_cast<KeptFrame*>(ptr);
+                static_cast<U*>(block.frame)->~U();
+                DeallocateFrame(block.frame, block.size);
+            };
+        }
+    }
+
+    void SetException(std::exception_ptr exception) noexcept
+    {
+        mException = std::move(exception);
+    }
+
+    // Rethrow the exception, or move out the value. Only works once.
+    template <typename T>
+    std::optional<T> Take()
+    {
+        RethrowIfAny();
+        if (mDestroy == nullptr)
+            return std::nullopt;
+
+        T* value;
+        if constexpr (IsInline<T>)
+            value = reinterpret_cast<T*>(mStorage);
+        else
+            value = static_cast<T*>(reinterpret_cast<KeptFrame*>(mStorage)->frame);
+
+        std::optional<T> result(std::move(*value));
+        Reset();
+        return result;
+    }
+
+    void RethrowIfAny()
+    {
+        if (mException)
+            std::rethrow_exception(std::exchange(mException, nullptr));
+    }
+
+    void Reset() noexcept
+    {
+        mException = nullptr;
+        if (mDestroy != nullptr)
+        {
+            mDestroy(mStorage);
+            mDestroy = nullptr;
+        }
+    }
+
+private:
+    static_assert(sizeof(KeptFrame) <= InlineSize);
+
+    alignas(std::max_align_t) unsigned char mStorage[InlineSize];
+    void (*mDestroy)(void*) noexcept = nullptr;
+    std::exception_ptr mException;
+};
+
 class CoroManager
 {
 public:
-    CoroManager()
+    // resource: where the coroutine frames and the internal containers are allocated.
+    //           Null means frames from the FramePool, containers from std::pmr::get_default_resource().
+    explicit CoroManager(std::pmr::memory_resource* resource = nullptr)
+        : CoroManager(resource ? resource : std::pmr::get_default_resource(), resource)
+    {
+    }
+
+    std::pmr::memory_resource* GetMemoryResource() const noexcept
     {
-        mLiveSignal = std::make_shared<std::monostate>();
+        return mFrameResource;
     }
 
     /// Start: start a coroutine and return its handle.
@@ -224,40 +640,77 @@ public:
         requires internal::ReturnsAsync<AsyncFunc, Args...> // Constrain that need function to return Async<T>
     [[nodiscard]] Handle<AsyncValueT<AsyncFunc, Args...>> Start(AsyncFunc&& func, Args&&... funcArgs)
     {
-        using RetType = AsyncValueT<AsyncFunc, Args...>;
+        return StartIn(mFrameResource, std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+    }
 
-        uint64_t id          = mNextId++;
-        auto [iter, succeed] = mCoroutines.emplace(id, Entry());
+    /// Spawn: start a fire and forget coroutine, the cheaper sched.Start(Something).Forget().
+    /// There's no handle to stop it or to read its result, it runs to its end or until the scheduler
+    /// is destroyed. Its result is discarded, and it's removed as soon as it finishes.
+    template <typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<AsyncFunc, Args...>
+    void Spawn(AsyncFunc&& func, Args&&... funcArgs)
+    {
+        SpawnIn(mFrameResource, std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+    }
 
-        Entry& newEntry = iter->second;
+protected:
+    // maxCoroutines: if not 0, the table never holds more, and is sized for exactly that many.
+    CoroManager(std::pmr::memory_resource* containerResource, std::pmr::memory_resource* frameResource, size_t maxCoroutines = 0)
+        : mRegistration(Registry::Register(this)),
+          mCoroutines(containerResource, mRegistration.firstGeneration, maxCoroutines ? CoroTable::ChunkBitsFor(maxCoroutines) : DefaultChunkBits),
+          mFrameResource(frameResource)
+    {
+    }
 
-        // Cache the input function and parameters into a lambda to avoid the famous C++ coroutine pitfall.
-        // https://devblogs.microsoft.com/oldnewthing/20211103-00/?p=105870
-        // <A capturing lambda can be a coroutine, but you have to save your captures while you still can>
-        newEntry.lambda = [task = std::forward<AsyncFunc>(func), tup = std::make_tuple(std::forward<Args>(funcArgs)...)]() mutable {
-            return std::apply(task, tup);
-        };
+    // Handles can't reach the scheduler from here on.
+    ~CoroManager()
+    {
+        Registry::Unregister(mRegistration.index, mCoroutines.LastGeneration());
+    }
 
-        // Create the Coro<T>
-        newEntry.coro = newEntry.lambda();
+    CoroManager(const CoroManager&)            = delete;
+    CoroManager& operator=(const CoroManager&) = delete;
 
-        Async<RetType>& newCoro = newEntry.coro.WithTmplArg<RetType>();
-        newCoro.SetId(id);
-        newCoro.SetCoroManager(this);
+    // Bytes of container memory for a table of at most maxCoroutines, see the constructor.
+    static constexpr size_t CoroTableBytes(size_t maxCoroutines) noexcept
+    {
+        return CoroTable::StorageBytes(maxCoroutines, CoroTable::ChunkBitsFor(maxCoroutines));
+    }
 
-        // Kick off the coroutine.
-        newCoro.Resume();
+    size_t CoroCount() const noexcept
+    {
+        return mCoroutines.Size();
+    }
 
-        // Check if the new coroutine already stopped running.
-        StopNewFinishedCoro();
+    // Start with the frames of the coroutine and all its nested coroutines allocated from resource.
+    // Null resource is the FramePool. CallInBlock: see StartStorage.
+    template <bool CallInBlock = false, typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<AsyncFunc, Args...>
+    Handle<AsyncValueT<AsyncFunc, Args...>> StartIn(std::pmr::memory_resource* resource, AsyncFunc&& func, Args&&... funcArgs)
+    {
+        using RetType = AsyncValueT<AsyncFunc, Args...>;
+        static_assert(!std::is_reference_v<RetType>, "Started coroutines can't return references, only awaited ones can.");
 
-        return Handle<RetType>{id, this, mLiveSignal};
+        const uint64_t id = Launch<false, CallInBlock>(resource, std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+        return Handle<RetType>{MakeHandleId(id)};
+    }
+
+    // Start without a handle, see SchedulerBP::Spawn.
+    template <bool CallInBlock = false, typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<AsyncFunc, Args...>
+    void SpawnIn(std::pmr::memory_resource* resource, AsyncFunc&& func, Args&&... funcArgs)
+    {
+        Launch<true, CallInBlock>(resource, std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
     }
 
-protected:
     void ClearCoros()
     {
-        mCoroutines.clear();
+        mCoroutines.Clear();
+    }
+
+    void ReserveCoros(size_t count)
+    {
+        mCoroutines.Reserve(count);
     }
 
     void StopNewFinishedCoro()
@@ -265,19 +718,23 @@ protected:
         if (mNewFinishedCoro == 0)
             return;
 
-        const auto it    = mCoroutines.find(mNewFinishedCoro);
-        mNewFinishedCoro = 0;
+        const uint64_t id = mNewFinishedCoro;
+        mNewFinishedCoro  = 0;
 
-        Entry& e = it->second;
-        assert(it != mCoroutines.end() && e.state == AsyncState::Running);
+        Entry* e = mCoroutines.Find(id);
+        assert(e != nullptr && e->state == AsyncState::Running);
 
-        e.state  = mNewFinishedSucceed ? AsyncState::Succeed : AsyncState::Failed;
-        e.lambda = {}; // Remove start lambda
+        e->state = mNewFinishedSucceed ? AsyncState::Succeed : AsyncState::Failed;
 
-        if (e.released)
+        if (e->released)
         {
             // When coro is stopped running and released by handle, we can delete it.
-            mCoroutines.erase(it);
+            mCoroutines.Erase(id);
+        }
+        else
+        {
+            // Keep only the result for the handle, and free the frame right away.
+            e->finish(*e);
         }
     }
 
@@ -287,33 +744,119 @@ private:
     template <typename T>
     friend class tokoro::Handle;
     friend class PromiseBase;
+    template <typename SchedulerT>
+    friend class tokoro::CoroScope;
+    template <typename Config>
+    friend class SchedulerStorage;
+
+    // A handle id is 64 bits: the scheduler's registry index in the top bits, the coroutine's slot id
+    // below. So at most 2^RegistryIndexBits schedulers are alive at once, and 2^SlotIndexBits root
+    // coroutines per scheduler. Generations are never reused per registry index, see SchedulerRegistry.
+    static constexpr uint32_t RegistryIndexBits  = 12;
+    static constexpr uint32_t SlotIndexBits      = 20;
+    static constexpr uint32_t SlotGenerationBits = 64 - RegistryIndexBits - SlotIndexBits;
+    static constexpr uint64_t SlotIdMask         = (uint64_t{1} << (SlotIndexBits + SlotGenerationBits)) - 1;
+
+    using Registry = BasicSchedulerRegistry<CoroManager, RegistryIndexBits, SlotGenerationBits>;
+
+    uint64_t MakeHandleId(uint64_t slotId) const noexcept
+    {
+        return (static_cast<uint64_t>(mRegistration.index) << (SlotIndexBits + SlotGenerationBits)) | slotId;
+    }
+
+    // Null if the scheduler of the handle is destroyed. May be a later scheduler, which finds none
+    // of the handle's coroutine ids.
+    static CoroManager* FromHandleId(uint64_t handleId) noexcept
+    {
+        return Registry::Find(static_cast<uint32_t>(handleId >> (SlotIndexBits + SlotGenerationBits)));
+    }
+
+    static uint64_t SlotId(uint64_t handleId) noexcept
+    {
+        return handleId & SlotIdMask;
+    }
+
+    // Create the root coroutine and run it to its first suspension. A spawned one has no handle, its
+    // entry is released from the start, so it's erased as soon as it finishes and keeps no result.
+    template <bool Spawned, bool CallInBlock, typename AsyncFunc, typename... Args>
+    uint64_t Launch(std::pmr::memory_resource* resource, AsyncFunc&& func, Args&&... funcArgs)
+    {
+        using RetType = AsyncValueT<AsyncFunc, Args...>;
+
+        FrameResourceScope frameScope(resource);
+
+        auto [id, newEntry] = mCoroutines.Emplace();
+
+        // Create the Coro<T>, with the function and parameters cached by the entry.
+        try
+        {
+            newEntry.coro = newEntry.start.template Start<CallInBlock>(std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+        }
+        catch (...)
+        {
+            mCoroutines.Erase(id); // E.g. no memory for the frame.
+            throw;
+        }
 
+        if constexpr (Spawned)
+            newEntry.released = true;
+        else
+            newEntry.finish = &FinishEntry<RetType>;
+
+        Async<RetType>& newCoro = newEntry.coro.WithTmplArg<RetType>();
+        newCoro.SetId(id);
+        newCoro.SetCoroManager(this);
+
+        // Kick off the coroutine.
+        newCoro.Resume();
+
+        // Check if the new coroutine already stopped running.
+        StopNewFinishedCoro();
+
+        return id;
+    }
+
+    // Ids of the methods below may be stale: the coroutine was destroyed with the scheduler's
+    // coroutines while its handle is still alive, e.g. handles held by other coroutines.
+
+    // The handle is gone, so is the result. Stop the coroutine too unless it was forgotten.
     void Release(uint64_t id)
     {
-        auto it = mCoroutines.find(id);
-        assert(it != mCoroutines.end() && !it->second.released);
+        Entry* entry = mCoroutines.Find(id);
+        if (entry == nullptr)
+            return;
+        assert(!entry->released);
 
-        it->second.released = true;
-        if (it->second.state != AsyncState::Running)
+        if (!entry->forgotten)
+            Stop(id);
+
+        entry->released = true;
+        if (entry->state != AsyncState::Running)
         {
             // When coro is stopped running and released by handle, we can delete it.
-            mCoroutines.erase(it);
+            mCoroutines.Erase(id);
         }
     }
 
-    void Stop(uint64_t id)
+    void Forget(uint64_t id)
     {
-        const auto it = mCoroutines.find(id);
-        assert(it != mCoroutines.end());
+        Entry* entry = mCoroutines.Find(id);
+        if (entry != nullptr)
+            entry->forgotten = true;
+    }
 
-        auto& entry = it->second;
-        assert(!entry.released && "Coroutines should not be released, if their handle is trying to stop (Handle still alive).");
+    void Stop(uint64_t id)
+    {
+        Entry* entry = mCoroutines.Find(id);
+        if (entry == nullptr)
+            return;
+        assert(!entry->released && "Coroutines should not be released, if their handle is trying to stop (Handle still alive).");
 
-        if (entry.state == AsyncState::Running)
+        if (entry->state == AsyncState::Running)
         {
-            entry.state = AsyncState::Stopped;
-            entry.coro.Reset(); // Remove the coro
-            entry.lambda = {};  // Remove start lambda
+            entry->state = AsyncState::Stopped;
+            entry->coro.Reset();  // Remove the coro
+            entry->start.Reset(); // Remove start function
         }
         else
         {
@@ -321,38 +864,52 @@ private:
         }
     }
 
-    AsyncState GetState(uint64_t id)
+    // Stop the coroutine, and drop its frame and result even if it already finished.
+    void Destroy(uint64_t id)
+    {
+        Entry* entry = mCoroutines.Find(id);
+        if (entry == nullptr)
+            return;
+
+        if (entry->state == AsyncState::Running)
+            entry->state = AsyncState::Stopped;
+        entry->coro.Reset();
+        entry->start.Reset();
+        entry->result.Reset();
+
+        if (entry->released)
+            mCoroutines.Erase(id);
+    }
+
+    std::optional<AsyncState> GetState(uint64_t id)
     {
-        const auto it = mCoroutines.find(id);
-        assert(it != mCoroutines.end());
+        const Entry* entry = mCoroutines.Find(id);
+        if (entry == nullptr)
+            return std::nullopt;
 
-        return it->second.state;
+        return entry->state;
     }
 
     template <typename T>
         requires(!std::is_void_v<T>)
     std::optional<T> TakeResult(uint64_t id)
     {
-        auto& entry = mCoroutines[id];
-        if (!entry.coro)
+        Entry* entry = mCoroutines.Find(id);
+        if (entry == nullptr)
             return std::nullopt;
 
-        auto      coro   = std::move(entry.coro);
-        Async<T>& asyncT = coro.WithTmplArg<T>();
-        return std::move(asyncT.GetCppHandle().promise().TakeResult());
+        return entry->result.Take<T>();
     }
 
     template <typename T>
         requires(std::is_void_v<T>)
     void TakeResult(uint64_t id)
     {
-        auto& entry = mCoroutines[id];
-        if (!entry.coro)
+        Entry* entry = mCoroutines.Find(id);
+        if (entry == nullptr)
             return;
 
-        auto         coro   = std::move(entry.coro);
-        Async<void>& asyncT = coro.WithTmplArg<void>();
-        asyncT.GetCppHandle().promise().TakeResult();
+        entry->result.RethrowIfAny();
     }
 
     void OnCoroutineFinished(uint64_t id, bool isSucceed)
@@ -371,27 +928,151 @@ private:
 
     struct Entry
     {
-        TmplAny<Async>                  coro;
-        std::function<TmplAny<Async>()> lambda;
-        AsyncState                      state    = AsyncState::Running;
-        bool                            released = false;
+        using FinishFunc = void (*)(Entry&) noexcept;
+
+        StartStorage   start; // Declared first, so the coro is destroyed before it.
+        TmplAny<Async> coro;
+        ResultSlot     result;
+        FinishFunc     finish    = nullptr;
+        AsyncState     state     = AsyncState::Running;
+        bool           released  = false;
+        bool           forgotten = false; // Keeps running when the handle is destroyed.
     };
 
-    uint64_t                            mNextId = 1;
-    std::unordered_map<uint64_t, Entry> mCoroutines;
-    uint64_t                            mNewFinishedCoro    = 0;
-    bool                                mNewFinishedSucceed = true;
-    std::shared_ptr<std::monostate>     mLiveSignal;
+    // Slot ids fit in a handle id below the registry id.
+    static constexpr uint32_t DefaultChunkBits = 8;
+
+    using CoroTable = SlotMap<Entry, DefaultChunkBits, SlotIndexBits, SlotGenerationBits>;
+
+    // Move the result of a finished coroutine into its slot, then free the frame and start function.
+    // Never throws, it runs inside Update(). If moving the result throws, the handle gets that
+    // exception instead, and the coroutine counts as failed.
+    template <typename T>
+    static void FinishEntry(Entry& entry) noexcept
+    {
+        auto& promise = entry.coro.WithTmplArg<T>().GetCppHandle().promise();
+        if (std::exception_ptr exception = promise.TakeException())
+        {
+            entry.result.SetException(std::move(exception));
+        }
+        else if constexpr (!std::is_void_v<T>)
+        {
+            try
+            {
+                TakeFinishedValue<T>(entry);
+            }
+            catch (...)
+            {
+                entry.state = AsyncState::Failed;
+                entry.result.Reset();
+                entry.result.SetException(std::current_exception());
+            }
+        }
+
+        entry.coro.Reset();
+        entry.start.Reset();
+    }
+
+    template <typename T>
+    static void TakeFinishedValue(Entry& entry)
+    {
+        const auto handle = entry.coro.WithTmplArg<T>().GetCppHandle();
+        if constexpr (ResultSlot::IsInline<T>)
+        {
+            entry.result.SetValue(handle.promise().TakeResult());
+        }
+        else
+        {
+            // A large result is moved aside, then into the block of the frame, which holds it for
+            // sure. So it needs no memory of its own, even when a fixed capacity scheduler has none.
+            FrameResourceScope frameScope(handle.promise().GetFrameResource());
+            T                  value = handle.promise().TakeResult();
+
+            KeptFrame kept{handle.address()};
+            tKeptFrame = &kept;
+            entry.coro.Reset();
+            tKeptFrame = nullptr;
+
+            entry.result.SetValue(std::move(value), kept);
+        }
+    }
+
+    Registry::Registration     mRegistration; // Before mCoroutines, which numbers its generations from it.
+    CoroTable                  mCoroutines;
+    std::pmr::memory_resource* mFrameResource      = nullptr;
+    uint64_t                   mNewFinishedCoro    = 0;
+    bool                       mNewFinishedSucceed = true;
+};
+
+template <typename Config>
+concept HasFixedCapacity = requires {
+    { Config::MaxCoroutines } -> std::convertible_to<size_t>;
+    { Config::FrameCount } -> std::convertible_to<size_t>;
+    { Config::FrameSize } -> std::convertible_to<size_t>;
+};
+
+// In-object storage of a fixed capacity scheduler, see FixedCapacityConfig. It's a base class so it
+// is constructed before CoroManager. Empty for other configs.
+template <typename Config>
+class SchedulerStorage
+{
+};
+
+template <HasFixedCapacity Config>
+class SchedulerStorage<Config>
+{
+protected:
+    SchedulerStorage() noexcept
+        : mTableResource(mTableBuffer, sizeof(mTableBuffer), std::pmr::null_memory_resource())
+    {
+    }
+
+    alignas(std::max_align_t) std::byte mTableBuffer[CoroManager::CoroTableBytes(Config::MaxCoroutines)];
+    std::pmr::monotonic_buffer_resource                                            mTableResource;
+    FixedBlockResource<Config::FrameSize + sizeof(FrameHeader), Config::FrameCount> mFrames;
 };
 
 } // namespace internal
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-class SchedulerBP : public internal::CoroManager
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+class SchedulerBP : private internal::SchedulerStorage<Config>, public internal::CoroManager
 {
 public:
+    // Time representation of TimeEnum, see TimeTraits.
+    using Duration = typename TimeTraits<TimeEnum>::Duration;
+    using TimeRep  = typename Duration::rep;
+
+    static constexpr bool FixedCapacity = internal::HasFixedCapacity<Config>;
+
     // Scheduler is neither copyable or movable.
-    SchedulerBP()                              = default;
+    SchedulerBP()
+        requires(!FixedCapacity)
+        : SchedulerBP(nullptr)
+    {
+    }
+
+    // All the coroutine frames and internal containers of the scheduler are allocated from resource,
+    // which must outlive the scheduler. Null is the default: frames from the FramePool, containers
+    // from std::pmr::get_default_resource().
+    explicit SchedulerBP(std::pmr::memory_resource* resource)
+        requires(!FixedCapacity)
+        : CoroManager(resource),
+          mExecuteQueues(MakeQueues(resource ? resource : std::pmr::get_default_resource(), std::make_index_sequence<UpdateQueueCount>{}))
+    {
+    }
+
+    // Fixed capacity: the coroutine table and the frames are in the scheduler object, see FixedCapacityConfig.
+    SchedulerBP()
+        requires(FixedCapacity)
+        : CoroManager(&this->mTableResource, &this->mFrames, Config::MaxCoroutines),
+          mExecuteQueues(MakeQueues(std::pmr::null_memory_resource(), std::make_index_sequence<UpdateQueueCount>{}))
+    {
+        static_assert(!std::is_constructible_v<typename Config::template TimeQueue<WaitBP<UpdateEnum, TimeEnum, Config>*, TimeRep>, std::pmr::memory_resource*>,
+                      "Fixed capacity schedulers need a time queue which doesn't allocate, like IntrusiveTimeQueue.");
+
+        CoroManager::ReserveCoros(Config::MaxCoroutines);
+    }
+
     SchedulerBP(const SchedulerBP&)            = delete;
     SchedulerBP& operator=(const SchedulerBP&) = delete;
     SchedulerBP(SchedulerBP&&)                 = delete;
@@ -409,17 +1090,117 @@ public:
         }
     }
 
+    // Reserve: pre-size the containers for a number of root coroutines alive at once, and of delayed
+    // waits pending at once in each (UpdateEnum, TimeEnum) queue. Once the frame pool is warmed up too
+    // (by use, or FramePool::Reserve), Start, Update, waits and nested co_await don't allocate.
+    // Except with MultisetTimeQueue, which allocates a node per delayed wait.
+    void Reserve(size_t coroutines, size_t waits)
+    {
+        CoroManager::ReserveCoros(coroutines);
+        for (auto& queue : mExecuteQueues)
+            queue.Reserve(waits);
+    }
+
+    using Timer = typename Config::template Timer<TimeEnum>;
+
     // SetCustomTimer: Set custom timer for specific time type to replace default realtime timer.
-    void SetCustomTimer(TimeEnum timeType, std::function<double()> getTimeFunc)
+    // The timer returns current time in TimeTraits<TimeEnum>::Duration units, seconds by default.
+    // Only for the DynamicTimer policy.
+    void SetCustomTimer(TimeEnum timeType, std::function<TimeRep()> getTimeFunc)
     {
-        mCustomTimers[static_cast<int>(timeType)] = std::move(getTimeFunc);
+        mTimer.SetCustomTimer(timeType, std::move(getTimeFunc));
+    }
+
+    Timer& GetTimer() noexcept
+    {
+        return mTimer;
+    }
+
+    // Same as CoroManager::Start. Delayed waits added before the coroutine first suspends share
+    // one timer read, see TimeSampling.
+    template <typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<AsyncFunc, Args...>
+    [[nodiscard]] Handle<internal::AsyncValueT<AsyncFunc, Args...>> Start(AsyncFunc&& func, Args&&... funcArgs)
+    {
+        return StartIn(GetMemoryResource(), std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+    }
+
+    /// StartMany: start func(arg) for every arg of args, in order, and write their handles to out.
+    /// The coroutine table grows once for the whole batch when the size of args is known, and the
+    /// delayed waits of the whole batch share one timer read, see TimeSampling.
+    /// Return value: the end of the written handles. When a fixed capacity scheduler fills up, the
+    ///               rest of the handles are invalid.
+    template <typename AsyncFunc, typename Range, std::output_iterator<Handle<internal::BatchValueT<AsyncFunc, Range>>> OutputIt>
+        requires internal::ReturnsAsyncForEach<AsyncFunc, Range>
+    OutputIt StartMany(AsyncFunc&& func, Range&& args, OutputIt out)
+    {
+        if constexpr (std::ranges::sized_range<Range> && !FixedCapacity)
+            CoroManager::ReserveCoros(CoroCount() + std::ranges::size(args));
+
+        SnapshotScope scope(*this);
+        for (auto&& arg : args)
+            *out++ = StartIn(GetMemoryResource(), func, std::forward<decltype(arg)>(arg));
+        return out;
+    }
+
+    template <typename AsyncFunc, typename Range>
+        requires internal::ReturnsAsyncForEach<AsyncFunc, Range>
+    [[nodiscard]] std::vector<Handle<internal::BatchValueT<AsyncFunc, Range>>> StartMany(AsyncFunc&& func, Range&& args)
+    {
+        std::vector<Handle<internal::BatchValueT<AsyncFunc, Range>>> handles;
+        if constexpr (std::ranges::sized_range<Range>)
+            handles.reserve(std::ranges::size(args));
+
+        StartMany(func, args, std::back_inserter(handles));
+        return handles;
+    }
+
+    /// StartDeferred: start a coroutine whose body first runs in the next Update(updateType) of the
+    /// default time type, among the other resumed waits, instead of inside this call. Only a small
+    /// start frame is created and queued here, func is called at that update.
+    /// Return value: same as Start(). Stopping it before that update means func is never called.
+    template <typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<std::decay_t<AsyncFunc>&, std::unwrap_ref_decay_t<Args>&...>
+    [[nodiscard]] Handle<internal::AsyncValueT<std::decay_t<AsyncFunc>&, std::unwrap_ref_decay_t<Args>&...>> StartDeferred(UpdateEnum updateType, AsyncFunc&& func, Args&&... funcArgs)
+    {
+        using RetType = internal::AsyncValueT<std::decay_t<AsyncFunc>&, std::unwrap_ref_decay_t<Args>&...>;
+
+        // The root coroutine. It's called with the function and arguments kept by the entry (see
+        // StartStorage), its parameters bind to them.
+        auto root = [](UpdateEnum resumeType, auto&& storedFunc, auto&&... storedArgs) -> Async<RetType> {
+            co_await MyWait(resumeType);
+            co_return co_await std::invoke(storedFunc, storedArgs...);
+        };
+        return StartIn(GetMemoryResource(), root, updateType, std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+    }
+
+    // Same as CoroManager::Spawn. Returns false when a fixed capacity scheduler is full or the
+    // frame doesn't fit a block, the coroutine isn't started then.
+    template <typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<AsyncFunc, Args...>
+    bool Spawn(AsyncFunc&& func, Args&&... funcArgs)
+    {
+        if (!HasRoomFor(GetMemoryResource()))
+            return false;
+
+        SnapshotScope scope(*this);
+        return FailFast([&] {
+            CoroManager::template SpawnIn<FixedCapacity>(GetMemoryResource(), std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+            return true;
+        });
     }
 
     void Update(UpdateEnum updateType = UpdateEnum::Update,
                 TimeEnum   timeType   = TimeEnum::Realtime)
     {
+        SnapshotScope scope(*this);
+
+        const TimeRep now = GetCurrentTime(timeType);
+        if constexpr (Config::Sampling == TimeSampling::Snapshot)
+            mTimeSnapshots[static_cast<int>(timeType)] = now;
+
         auto& timeQueue = GetUpdateQueue(updateType, timeType);
-        timeQueue.SetupUpdate(GetCurrentTime(timeType));
+        timeQueue.SetupUpdate(now);
 
         while (timeQueue.CheckUpdate())
         {
@@ -430,8 +1211,63 @@ public:
     }
 
 private:
-    using MyWait = WaitBP<UpdateEnum, TimeEnum>;
+    using MyWait    = WaitBP<UpdateEnum, TimeEnum, Config>;
+    using QueueType = typename MyWait::QueueType;
     friend MyWait;
+    friend class CoroScope<SchedulerBP>;
+
+    template <typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<AsyncFunc, Args...>
+    Handle<internal::AsyncValueT<AsyncFunc, Args...>> StartIn(std::pmr::memory_resource* resource, AsyncFunc&& func, Args&&... funcArgs)
+    {
+        // Report a full scheduler with an invalid handle, never allocate.
+        if (!HasRoomFor(resource))
+            return {};
+
+        SnapshotScope scope(*this);
+        return FailFast([&] {
+            return CoroManager::template StartIn<FixedCapacity>(resource, std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+        });
+    }
+
+    // The frame size is only known when the frame is allocated, inside the start. A fixed capacity
+    // scheduler's block resource throws std::bad_alloc for a frame (or start function, see
+    // StartStorage) larger than Config::FrameSize, or when the blocks run out. The start undoes the
+    // entry then, report it like a full scheduler: an invalid handle, or false.
+    template <typename StartFunc>
+    static auto FailFast(StartFunc&& start)
+    {
+        if constexpr (FixedCapacity)
+        {
+            try
+            {
+                return start();
+            }
+            catch (const std::bad_alloc&)
+            {
+                return decltype(start()){};
+            }
+        }
+        else
+        {
+            return start();
+        }
+    }
+
+    // Whether a root coroutine with its frame from resource can start. Always for unbounded schedulers.
+    bool HasRoomFor(std::pmr::memory_resource* resource) const noexcept
+    {
+        if constexpr (FixedCapacity)
+            return CoroCount() < Config::MaxCoroutines && !(resource == &this->mFrames && this->mFrames.Full());
+        else
+            return true;
+    }
+
+    template <size_t... Is>
+    static std::array<QueueType, sizeof...(Is)> MakeQueues(std::pmr::memory_resource* resource, std::index_sequence<Is...>)
+    {
+        return {((void)Is, QueueType(resource))...};
+    }
 
     int TypesToIndex(UpdateEnum updateType, TimeEnum timeType)
     {
@@ -440,74 +1276,148 @@ private:
         return updateIndex * static_cast<int>(TimeEnum::Count) + timeIndex;
     }
 
-    internal::TimeQueue<MyWait*>& GetUpdateQueue(UpdateEnum updateType, TimeEnum timeType)
+    QueueType& GetUpdateQueue(UpdateEnum updateType, TimeEnum timeType)
     {
         int queueIndex = TypesToIndex(updateType, timeType);
         return mExecuteQueues[queueIndex];
     }
 
-    std::function<double()>& GetCustomTimer(TimeEnum timeType)
+    TimeRep GetCurrentTime(TimeEnum timeType)
     {
-        return mCustomTimers[static_cast<int>(timeType)];
+        return mTimer.Now(timeType);
     }
 
-    static double defaultTimer()
+    // Time base of new delayed waits.
+    TimeRep GetWaitBaseTime(TimeEnum timeType)
     {
-        using Clock     = std::chrono::steady_clock;
-        using TimePoint = Clock::time_point;
-
-        static TimePoint                    startTime = Clock::now();
-        const std::chrono::duration<double> diff      = Clock::now() - startTime;
-        return diff.count();
+        if constexpr (Config::Sampling == TimeSampling::Snapshot)
+        {
+            if (mSnapshotDepth != 0)
+            {
+                std::optional<TimeRep>& snapshot = mTimeSnapshots[static_cast<int>(timeType)];
+                if (!snapshot)
+                    snapshot = GetCurrentTime(timeType);
+                return *snapshot;
+            }
+        }
+        return GetCurrentTime(timeType);
     }
 
-    double GetCurrentTime(TimeEnum timeType)
+    // Timer reads inside share snapshots, which are dropped when the outermost scope ends.
+    class SnapshotScope
     {
-        auto& customTimer = GetCustomTimer(timeType);
-        if (customTimer)
+    public:
+        explicit SnapshotScope(SchedulerBP& scheduler) noexcept
+            : mScheduler(scheduler)
         {
-            return customTimer();
+            ++mScheduler.mSnapshotDepth;
         }
-        else
+
+        ~SnapshotScope()
         {
-            return defaultTimer();
+            if (--mScheduler.mSnapshotDepth == 0)
+                mScheduler.mTimeSnapshots.fill(std::nullopt);
         }
-    }
 
-    using WaitIter = typename internal::TimeQueue<MyWait*>::Iterator;
-    WaitIter AddWait(MyWait* wait, UpdateEnum updateType, TimeEnum timeType)
+    private:
+        SchedulerBP& mScheduler;
+    };
+
+    void AddWait(MyWait* wait, UpdateEnum updateType, TimeEnum timeType)
     {
         auto& timeQueue = GetUpdateQueue(updateType, timeType);
 
-        double executeTime = 0;
-        if (wait->mDelay != 0)
-            executeTime = GetCurrentTime(timeType) + wait->mDelay;
-        return timeQueue.AddTimed(executeTime, wait);
+        if (wait->mFrames != 0)
+            timeQueue.AddFrames(*wait, wait->mFrames);
+        else if (wait->mDelay == 0)
+            timeQueue.AddNext(*wait);
+        else
+            timeQueue.AddTimed(*wait, GetWaitBaseTime(timeType) + wait->mDelay);
     }
 
-    void RemoveWait(WaitIter waitHandle, UpdateEnum updateType, TimeEnum timeType)
+    void RemoveWait(MyWait* wait, UpdateEnum updateType, TimeEnum timeType)
     {
         auto& timeQueue = GetUpdateQueue(updateType, timeType);
-        timeQueue.Remove(waitHandle);
+        timeQueue.Remove(*wait);
     }
 
     static constexpr int UpdateQueueCount = static_cast<int>(UpdateEnum::Count) * static_cast<int>(TimeEnum::Count);
 
-    std::array<internal::TimeQueue<MyWait*>, UpdateQueueCount>             mExecuteQueues;
-    std::array<std::function<double()>, static_cast<int>(TimeEnum::Count)> mCustomTimers;
+    std::array<QueueType, UpdateQueueCount>                               mExecuteQueues;
+    Timer                                                                 mTimer;
+    std::array<std::optional<TimeRep>, static_cast<int>(TimeEnum::Count)> mTimeSnapshots;
+    uint32_t                                                              mSnapshotDepth = 0;
+};
+
+// Group of coroutines whose frames, nested ones included, come from a bump arena owned by the scope.
+// Stop() destroys all of them in one pass and releases the arena at once, e.g. when a level unloads.
+// Handles stay usable: running coroutines report AsyncState::Stopped, and results not taken yet are dropped.
+//
+// The arena's buffers and the list of ids come from the scheduler's memory resource, or the default
+// one when it has none.
+//
+// Frames of coroutines which finish early are only reclaimed by Stop(), so it suits groups with a
+// bounded lifetime. A scope must not outlive its scheduler, and must not be stopped from inside one
+// of its coroutines.
+template <typename SchedulerT>
+class CoroScope
+{
+    // Their frames are blocks of a fixed size, an arena can't grow in them.
+    static_assert(!SchedulerT::FixedCapacity, "CoroScope needs a scheduler without fixed capacity.");
+
+public:
+    explicit CoroScope(SchedulerT& scheduler, size_t initialArenaSize = 64 * 1024)
+        : mScheduler(scheduler),
+          mArena(initialArenaSize, UpstreamOf(scheduler)),
+          mIds(UpstreamOf(scheduler))
+    {
+    }
+
+    CoroScope(const CoroScope&)            = delete;
+    CoroScope& operator=(const CoroScope&) = delete;
+
+    ~CoroScope()
+    {
+        Stop();
+    }
+
+    // Same as SchedulerBP::Start, but the coroutine belongs to this scope.
+    template <typename AsyncFunc, typename... Args>
+        requires internal::ReturnsAsync<AsyncFunc, Args...>
+    [[nodiscard]] Handle<internal::AsyncValueT<AsyncFunc, Args...>> Start(AsyncFunc&& func, Args&&... funcArgs)
+    {
+        auto handle = mScheduler.StartIn(&mArena, std::forward<AsyncFunc>(func), std::forward<Args>(funcArgs)...);
+        mIds.push_back(internal::CoroManager::SlotId(handle.mId));
+        return handle;
+    }
+
+    void Stop()
+    {
+        for (uint64_t id : mIds)
+            mScheduler.Destroy(id);
+        mIds.clear();
+        mArena.release();
+    }
+
+private:
+    static std::pmr::memory_resource* UpstreamOf(const SchedulerT& scheduler) noexcept
+    {
+        std::pmr::memory_resource* resource = scheduler.GetMemoryResource();
+        return resource ? resource : std::pmr::get_default_resource();
+    }
+
+    SchedulerT&                         mScheduler;
+    std::pmr::monotonic_buffer_resource mArena;
+    std::pmr::vector<uint64_t>          mIds;
 };
 
 // Handle functions
 //
 template <typename T>
 Handle<T>::Handle(Handle&& other) noexcept
-    : mId(other.mId),
-      mBoundLifetime(other.mBoundLifetime),
-      mCoroMgr(other.mCoroMgr),
-      mCoroMgrLiveSignal(std::move(other.mCoroMgrLiveSignal))
+    : mId(other.mId)
 {
-    other.mId      = 0;
-    other.mCoroMgr = nullptr;
+    other.mId = 0;
 }
 
 template <typename T>
@@ -517,13 +1427,8 @@ Handle<T>& Handle<T>::operator=(Handle&& other) noexcept
     {
         Reset();
 
-        mId                = other.mId;
-        mBoundLifetime     = other.mBoundLifetime;
-        mCoroMgr           = other.mCoroMgr;
-        mCoroMgrLiveSignal = std::move(other.mCoroMgrLiveSignal);
-
-        other.mId      = 0;
-        other.mCoroMgr = nullptr;
+        mId       = other.mId;
+        other.mId = 0;
     }
     return *this;
 }
@@ -546,14 +1451,18 @@ void Handle<T>::Stop() const noexcept
     if (!IsValid())
         return;
 
-    if (!mCoroMgrLiveSignal.expired())
-        mCoroMgr->Stop(mId);
+    if (internal::CoroManager* coroMgr = internal::CoroManager::FromHandleId(mId))
+        coroMgr->Stop(internal::CoroManager::SlotId(mId));
 }
 
 template <typename T>
 void Handle<T>::Forget() noexcept
 {
-    mBoundLifetime = false;
+    if (!IsValid())
+        return;
+
+    if (internal::CoroManager* coroMgr = internal::CoroManager::FromHandleId(mId))
+        coroMgr->Forget(internal::CoroManager::SlotId(mId));
 }
 
 template <typename T>
@@ -562,8 +1471,8 @@ std::optional<AsyncState> Handle<T>::GetState() const noexcept
     if (!IsValid())
         return std::nullopt;
 
-    if (!mCoroMgrLiveSignal.expired())
-        return mCoroMgr->GetState(mId);
+    if (internal::CoroManager* coroMgr = internal::CoroManager::FromHandleId(mId))
+        return coroMgr->GetState(internal::CoroManager::SlotId(mId));
     else
         return std::nullopt;
 }
@@ -586,13 +1495,15 @@ std::optional<T> Handle<T>::TakeResult() const
     if (!IsValid())
         return std::nullopt;
 
-    if (mCoroMgrLiveSignal.expired())
+    internal::CoroManager* coroMgr = internal::CoroManager::FromHandleId(mId);
+    if (coroMgr == nullptr)
         return std::nullopt;
 
-    if (GetState().value() == AsyncState::Running)
+    const auto state = GetState();
+    if (!state.has_value() || state.value() == AsyncState::Running)
         return std::nullopt;
 
-    return mCoroMgr->TakeResult<T>(mId);
+    return coroMgr->TakeResult<T>(internal::CoroManager::SlotId(mId));
 }
 
 template <typename T>
@@ -602,87 +1513,117 @@ void Handle<T>::TakeResult() const
     if (!IsValid())
         return;
 
-    if (mCoroMgrLiveSignal.expired())
+    internal::CoroManager* coroMgr = internal::CoroManager::FromHandleId(mId);
+    if (coroMgr == nullptr)
         return;
 
-    if (GetState().value() == AsyncState::Running)
+    const auto state = GetState();
+    if (!state.has_value() || state.value() == AsyncState::Running)
         return;
 
-    mCoroMgr->TakeResult<T>(mId);
+    coroMgr->TakeResult<T>(internal::CoroManager::SlotId(mId));
 }
 
 template <typename T>
 void Handle<T>::Reset()
 {
-    if (mId != 0 && !mCoroMgrLiveSignal.expired())
-    {
-        if (mBoundLifetime)
-            mCoroMgr->Stop(mId);
-        mCoroMgr->Release(mId);
+    if (!IsValid())
+        return;
 
-        mId      = 0;
-        mCoroMgr = nullptr;
-        mCoroMgrLiveSignal.reset();
-        mBoundLifetime = true;
-    }
+    if (internal::CoroManager* coroMgr = internal::CoroManager::FromHandleId(mId))
+        coroMgr->Release(internal::CoroManager::SlotId(mId));
+    mId = 0;
 }
 
 // TimeAwaiter functions
 //
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-WaitBP<UpdateEnum, TimeEnum>::WaitBP(double sec, UpdateEnum updateType, TimeEnum timeType)
-    : mDelay(sec),
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+WaitBP<UpdateEnum, TimeEnum, Config>::WaitBP(double sec, UpdateEnum updateType, TimeEnum timeType)
+    : mDelay(ToDelay(std::chrono::duration<double>(sec))),
       mUpdateType(updateType), mTimeType(timeType)
 {
 }
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-WaitBP<UpdateEnum, TimeEnum>::WaitBP(UpdateEnum updateType, TimeEnum timeType)
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+template <typename Rep, typename Period>
+WaitBP<UpdateEnum, TimeEnum, Config>::WaitBP(std::chrono::duration<Rep, Period> delay, UpdateEnum updateType, TimeEnum timeType)
+    : mDelay(ToDelay(delay)),
+      mUpdateType(updateType), mTimeType(timeType)
+{
+}
+
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+template <typename Rep, typename Period>
+auto WaitBP<UpdateEnum, TimeEnum, Config>::ToDelay(std::chrono::duration<Rep, Period> delay) -> TimeRep
+{
+    if constexpr (std::chrono::treat_as_floating_point_v<TimeRep>)
+        return std::chrono::duration_cast<Duration>(delay).count();
+    else
+        return std::chrono::ceil<Duration>(delay).count();
+}
+
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+WaitBP<UpdateEnum, TimeEnum, Config>::WaitBP(UpdateEnum updateType, TimeEnum timeType)
     : mDelay(0), mUpdateType(updateType), mTimeType(timeType)
 {
 }
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-WaitBP<UpdateEnum, TimeEnum>::~WaitBP()
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+WaitBP<UpdateEnum, TimeEnum, Config>::~WaitBP()
 {
-    if (mExeIter.has_value())
+    if (this->IsLinked())
     {
         auto coroMgrPtr   = mHandle.promise().GetCoroManager();
-        auto schedulerPtr = static_cast<SchedulerBP<UpdateEnum, TimeEnum>*>(coroMgrPtr);
-        schedulerPtr->RemoveWait(*mExeIter, mUpdateType, mTimeType);
+        auto schedulerPtr = static_cast<SchedulerBP<UpdateEnum, TimeEnum, Config>*>(coroMgrPtr);
+        schedulerPtr->RemoveWait(this, mUpdateType, mTimeType);
     }
 }
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-bool WaitBP<UpdateEnum, TimeEnum>::await_ready() const noexcept
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+bool WaitBP<UpdateEnum, TimeEnum, Config>::await_ready() const noexcept
 {
     return false;
 }
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
 template <typename T>
-void WaitBP<UpdateEnum, TimeEnum>::await_suspend(std::coroutine_handle<internal::Promise<T>> handle) noexcept
+void WaitBP<UpdateEnum, TimeEnum, Config>::await_suspend(std::coroutine_handle<internal::Promise<T>> handle) noexcept
 {
     mHandle           = std::coroutine_handle<internal::PromiseBase>::from_address(handle.address());
     auto coroMgrPtr   = mHandle.promise().GetCoroManager();
-    auto schedulerPtr = static_cast<SchedulerBP<UpdateEnum, TimeEnum>*>(coroMgrPtr);
-    mExeIter          = schedulerPtr->AddWait(this, mUpdateType, mTimeType);
+    auto schedulerPtr = static_cast<SchedulerBP<UpdateEnum, TimeEnum, Config>*>(coroMgrPtr);
+    schedulerPtr->AddWait(this, mUpdateType, mTimeType);
 }
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-void WaitBP<UpdateEnum, TimeEnum>::await_resume() const noexcept
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+void WaitBP<UpdateEnum, TimeEnum, Config>::await_resume() const noexcept
 {
 }
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
-void WaitBP<UpdateEnum, TimeEnum>::Resume()
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+void WaitBP<UpdateEnum, TimeEnum, Config>::Resume()
 {
-    assert(mHandle && !mHandle.done() && mExeIter.has_value());
-    // mExeIter has been removed from mExecuteQueue before enter Resume().
-    mExeIter.reset();
+    // The wait has been removed from mExecuteQueue before enter Resume().
+    assert(mHandle && !mHandle.done() && !this->IsLinked());
+    internal::FrameResourceScope frameScope(mHandle.promise().GetFrameResource());
     mHandle.resume();
 }
 
+// WaitFramesBP functions
+//
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+WaitFramesBP<UpdateEnum, TimeEnum, Config>::WaitFramesBP(uint32_t frames, UpdateEnum updateType, TimeEnum timeType)
+    : WaitBP<UpdateEnum, TimeEnum, Config>(updateType, timeType)
+{
+    this->mFrames = frames;
+}
+
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config>
+bool WaitFramesBP<UpdateEnum, TimeEnum, Config>::await_ready() const noexcept
+{
+    return this->mFrames == 0;
+}
+
 //  Awaiter for All: waits all, returns tuple<T1, T2, T3 ...>
 //
 template <typename... Ts>
@@ -692,6 +1633,7 @@ private:
     std::tuple<Async<Ts>...>                     mWaitedCoros;
     std::size_t                                  mRemainingCount;
     std::coroutine_handle<internal::PromiseBase> mParentHandle;
+    bool                                         mStarting = false;
 
 public:
     All(Async<Ts>&&... cs)
@@ -704,8 +1646,9 @@ public:
         return mRemainingCount == 0;
     }
 
+    // Returns false when all the children finished without suspending, the parent goes on inline then.
     template <typename T>
-    void await_suspend(std::coroutine_handle<internal::Promise<T>> h) noexcept
+    bool await_suspend(std::coroutine_handle<internal::Promise<T>> h) noexcept
     {
         mParentHandle = std::coroutine_handle<internal::PromiseBase>::from_address(h.address());
 
@@ -722,37 +1665,37 @@ public:
                 ...);
         };
 
+        mStarting = true;
         resumeWithIndexes(std::index_sequence_for<Ts...>{});
+        mStarting = false;
+
+        return mRemainingCount != 0;
     }
 
     auto await_resume()
     {
-        std::tuple<internal::RetConvert<Ts>...> results;
-
-        auto storeResults = [this, &results]<std::size_t... Is>(std::index_sequence<Is...>) {
-            ([this, &results] {
+        // Construct the results in place, in order, so they needn't be default constructible.
+        auto takeResults = [this]<std::size_t... Is>(std::index_sequence<Is...>) {
+            return std::tuple<internal::RetConvert<Ts>...>{[this]() -> internal::RetConvert<Ts> {
                 auto& coro = std::get<Is>(mWaitedCoros);
-                using T    = std::tuple_element_t<Is, std::tuple<Ts...>>;
-                if constexpr (std::is_void_v<T>)
+                if constexpr (std::is_void_v<Ts>)
                 {
                     coro.GetCppHandle().promise().TakeResult();
-                    std::get<Is>(results) = std::monostate{};
+                    return std::monostate{};
                 }
                 else
                 {
-                    std::get<Is>(results) = std::move(coro.GetCppHandle().promise().TakeResult());
+                    return coro.GetCppHandle().promise().TakeResult();
                 }
-            }(),
-             ...);
+            }()...};
         };
 
-        storeResults(std::index_sequence_for<Ts...>{});
-        return std::move(results);
+        return takeResults(std::index_sequence_for<Ts...>{});
     }
 
     std::coroutine_handle<> OnWaitComplete(std::coroutine_handle<> h) noexcept override
     {
-        if (--mRemainingCount == 0)
+        if (--mRemainingCount == 0 && !mStarting)
             return mParentHandle;
         else
             return std::noop_coroutine();
@@ -769,6 +1712,7 @@ private:
     std::coroutine_handle<>                                mFirstFinish;
     std::tuple<std::optional<internal::RetConvert<Ts>>...> mResults;
     std::coroutine_handle<internal::PromiseBase>           mParentHandle;
+    bool                                                   mStarting = false;
 
 public:
     Any(Async<Ts>&&... cs)
@@ -781,13 +1725,18 @@ public:
         return false;
     }
 
+    // Returns false when a child finished without suspending. The parent goes on inline then, and
+    // the children after it are never started.
     template <typename T>
-    void await_suspend(std::coroutine_handle<internal::Promise<T>> h) noexcept
+    bool await_suspend(std::coroutine_handle<internal::Promise<T>> h) noexcept
     {
         mParentHandle = std::coroutine_handle<internal::PromiseBase>::from_address(h.address());
 
         auto resumeWithIndexes = [this]<std::size_t... Is>(std::index_sequence<Is...>) {
             ([this] {
+                if (mFirstFinish)
+                    return;
+
                 auto& coro    = std::get<Is>(mWaitedCoros.value());
                 auto  handle  = coro.GetCppHandle();
                 auto& promise = handle.promise();
@@ -797,7 +1746,12 @@ public:
             }(),
              ...);
         };
+
+        mStarting = true;
         resumeWithIndexes(std::index_sequence_for<Ts...>{});
+        mStarting = false;
+
+        return !mFirstFinish;
     }
 
     auto await_resume()
@@ -817,7 +1771,7 @@ public:
                 }
                 else
                 {
-                    std::get<Is>(mResults) = std::move(coro.GetCppHandle().promise().TakeResult());
+                    std::get<Is>(mResults).emplace(coro.GetCppHandle().promise().TakeResult());
                 }
             }(),
              ...);
@@ -825,12 +1779,14 @@ public:
         checkStoreWithIndexes(std::index_sequence_for<Ts...>{});
 
         mWaitedCoros.reset();
-        return mResults;
+        return std::move(mResults);
     }
 
     std::coroutine_handle<> OnWaitComplete(std::coroutine_handle<> h) noexcept override
     {
         mFirstFinish = h;
+        if (mStarting)
+            return std::noop_coroutine();
         return mParentHandle;
     }
 };
@@ -842,28 +1798,32 @@ public:
 namespace tokoro
 {
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config = DefaultSchedulerConfig>
 Async<void> WaitUntilBP(std::function<bool()>&& checkFunc)
 {
     while (!checkFunc())
     {
-        co_await WaitBP<UpdateEnum, TimeEnum>(internal::GetEnumDefault<UpdateEnum>());
+        co_await WaitBP<UpdateEnum, TimeEnum, Config>(internal::GetEnumDefault<UpdateEnum>());
     }
 }
 
-template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum>
+template <internal::CountEnum UpdateEnum, internal::CountEnum TimeEnum, typename Config = DefaultSchedulerConfig>
 Async<void> WaitWhileBP(std::function<bool()>&& checkFunc)
 {
     while (checkFunc())
     {
-        co_await WaitBP<UpdateEnum, TimeEnum>(internal::GetEnumDefault<UpdateEnum>());
+        co_await WaitBP<UpdateEnum, TimeEnum, Config>(internal::GetEnumDefault<UpdateEnum>());
     }
 }
 
+// Coroutine frame cache of current thread. Reserve() pre-warms it, Trim() gives memory back after spikes.
+using FramePool = internal::FramePool;
+
 // Define preset types for quick setup.
 //
 using Scheduler       = SchedulerBP<internal::PresetUpdateType, internal::PresetTimeType>;
 using Wait            = WaitBP<internal::PresetUpdateType, internal::PresetTimeType>;
+using WaitFrames      = WaitFramesBP<internal::PresetUpdateType, internal::PresetTimeType>;
 inline auto WaitUntil = WaitUntilBP<internal::PresetUpdateType, internal::PresetTimeType>;
 inline auto WaitWhile = WaitWhileBP<internal::PresetUpdateType, internal::PresetTimeType>;
 